@@ -0,0 +1,42 @@
+#!/bin/bash
+
+function capture_time {
+    # Start Timestamp
+    STARTTIME=`date +%s.%N`
+    
+    # Commands here (eg: TCP connect test or something useful)
+    THREAD_WORKERS=$1 $2 $3 >> /dev/null
+    
+    # End timestamp
+    ENDTIME=`date +%s.%N`
+    
+    # Convert nanoseconds to milliseconds
+    # crudely by taking first 3 decimal places
+    TIMEDIFF=`echo "$ENDTIME - $STARTTIME" | bc | awk -F"." '{print $1"."substr($2,1,6)}'`
+    echo $TIMEDIFF
+}
+
+function average {
+    SUM=0
+    for i in `seq 1 $1`;
+    do
+	TIMEDIFF=`capture_time $2 $3 $4`
+	SUM=`echo "$SUM + $TIMEDIFF" | bc | awk -F"." '{print $1"."substr($2,1,6)}'`
+    done
+    AVG=`bc -l <<< "$SUM/$1"`
+    AVG=`echo "$AVG" | awk -F"." '{print "0"$1"."substr($2,1,6)}'`
+    echo $AVG
+}
+
+# Nombre de coeurs par défaut
+MAX=${4:-`nproc`}
+
+echo "Test de performance de $1 $3 pour un nombre de workers variant de 1 à $MAX (bibliothèque compilée avec -DUSE_MN=ON). Les résultats seront affichés dans le fichier $2."
+echo "# Fichier généré automatiquement pour le test $1 $3 avec le script workers.sh" > $2
+for i in `seq 1 $MAX`;
+do
+    echo "$i"
+    TIME=`average 10 $i $1 $3`
+    echo "$i $TIME" >> $2
+done
+echo "Fin"
@@ -0,0 +1,97 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "define.h"
+
+/**
+ * @brief thread_attr_init gives the attributes of thread_create
+ * @param attr the attributes to initialize
+ * @return EXIT_SUCCESS
+ */
+int thread_attr_init(thread_attr_t *attr)
+{
+    attr->stack_size = STACK_SIZE;
+    attr->priority = 5;
+    attr->period = 0;
+    attr->deadline = 0;
+    attr->detachstate = THREAD_CREATE_JOINABLE;
+    attr->name[0] = '\0';
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief thread_attr_setstacksize sets the size of the stack
+ * @param attr the attributes
+ * @param stack_size the size in bytes, rounded up to a multiple of the page size at the creation
+ * @return EXIT_SUCCESS on success
+ *         EINVAL if the stack cannot hold the frames of the signal handlers
+ */
+int thread_attr_setstacksize(thread_attr_t *attr, size_t stack_size)
+{
+    if (stack_size < STACK_MIN)
+        return EINVAL;
+    attr->stack_size = stack_size;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief thread_attr_setpriority sets the priority
+ * @param attr the attributes
+ * @param priority between 1 and 10
+ * @return EXIT_SUCCESS on success
+ *         EINVAL if the priority is not valid
+ */
+int thread_attr_setpriority(thread_attr_t *attr, unsigned short priority)
+{
+    if (priority < 1 || priority > 10)
+        return EINVAL;
+    attr->priority = priority;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief thread_attr_setdeadline makes the thread periodic, scheduled by earliest deadline first
+ * @param attr the attributes
+ * @param period the period in microseconds, 0 for a thread which is not periodic
+ * @param deadline the deadline of each job from the start of its period, 0 for the period
+ * @return EXIT_SUCCESS on success
+ *         EINVAL if the deadline is after the end of the period
+ */
+int thread_attr_setdeadline(thread_attr_t *attr, unsigned int period, unsigned int deadline)
+{
+    if (deadline > period)
+        return EINVAL;
+    attr->period = period;
+    attr->deadline = deadline;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief thread_attr_setdetachstate sets the detach state
+ * @param attr the attributes
+ * @param detachstate THREAD_CREATE_JOINABLE or THREAD_CREATE_DETACHED
+ * @return EXIT_SUCCESS on success
+ *         EINVAL if detachstate is not valid
+ */
+int thread_attr_setdetachstate(thread_attr_t *attr, int detachstate)
+{
+    if (detachstate != THREAD_CREATE_JOINABLE && detachstate != THREAD_CREATE_DETACHED)
+        return EINVAL;
+    attr->detachstate = detachstate;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief thread_attr_setname sets the name
+ * @param attr the attributes
+ * @param name the name, truncated to THREAD_NAME_SIZE - 1 characters
+ * @return EXIT_SUCCESS
+ */
+int thread_attr_setname(thread_attr_t *attr, const char *name)
+{
+    strncpy(attr->name, name, THREAD_NAME_SIZE - 1);
+    attr->name[THREAD_NAME_SIZE - 1] = '\0';
+    return EXIT_SUCCESS;
+}
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,343 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include <string.h>
+#include "define.h"
+#include "scheduler.h"
+
+/*
+ * ##############################################################################################
+ * ######                                  Waiters                                         ######
+ * ##############################################################################################
+ */
+
+/**
+ * \struct chan_select a thread sleeping in thread_chan_select, on its stack
+ */
+struct chan_select
+{
+    thread *th;
+    int done; /*!< index of the operation done, -1 while the thread waits */
+    int status; /*!< 0, or EPIPE if the channel of the operation done was closed */
+};
+
+/**
+ * \struct chan_waiter an operation of a thread sleeping, in the queue of its channel, on the stack of
+ * the thread. The operations of a select are in the queues of all their channels, the first one
+ * done completes the others: they stay in their queues until the thread wakes up, and are skipped
+ */
+struct chan_waiter
+{
+    struct chan_select *select;
+    int index; /*!< index of the operation in the select */
+    void *item; /*!< the item to send, or where to receive it */
+    TAILQ_ENTRY(chan_waiter) entries;
+};
+
+/**
+ * @brief chan_take removes the first operation of a queue whose thread still waits, g_lock is held
+ * @return the operation, NULL if none
+ */
+static struct chan_waiter *chan_take(struct thread_chan_waiters *queue)
+{
+    struct chan_waiter *w;
+    TAILQ_FOREACH(w, queue, entries)
+    {
+        if (w->select->done < 0)
+        {
+            TAILQ_REMOVE(queue, w, entries);
+            return w;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief chan_complete wakes up the thread of an operation done, g_lock is held
+ * @param w the operation, out of its queue
+ * @param status 0, or EPIPE if the channel is closed
+ */
+static void chan_complete(struct chan_waiter *w, int status)
+{
+    w->select->done = w->index;
+    w->select->status = status;
+    runq_wake(w->select->th);
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                 Operations                                       ######
+ * ##############################################################################################
+ */
+
+/**
+ * @brief chan_push copies an item at the end of the ring, which is not full
+ */
+static void chan_push(thread_chan_t *chan, const void *item)
+{
+    unsigned int tail = chan->head + chan->count;
+    if (tail >= chan->capacity)
+        tail -= chan->capacity;
+    memcpy(chan->buffer + tail * chan->item_size, item, chan->item_size);
+    chan->count++;
+}
+
+/**
+ * @brief chan_send sends an item if it can be done without waiting, g_lock is held
+ * The receivers only wait while the ring is empty: the first one gets the item directly
+ * @return 0 on success, EAGAIN if the channel is full, EPIPE if it is closed
+ */
+static int chan_send(thread_chan_t *chan, const void *item)
+{
+    if (chan->closed)
+        return EPIPE;
+
+    struct chan_waiter *w = chan_take(&(chan->receivers));
+    if (w != NULL)
+    {
+        memcpy(w->item, item, chan->item_size);
+        chan_complete(w, 0);
+        return EXIT_SUCCESS;
+    }
+
+    if (chan->count == chan->capacity)
+        return EAGAIN;
+    chan_push(chan, item);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief chan_recv receives an item if it can be done without waiting, g_lock is held
+ * The senders only wait while the ring is full: the item of the first one takes the room freed, or
+ * is received directly without a ring (capacity 0)
+ * @return 0 on success, EAGAIN if the channel is empty, EPIPE if it is closed and empty
+ */
+static int chan_recv(thread_chan_t *chan, void *item)
+{
+    struct chan_waiter *w;
+
+    if (chan->count > 0)
+    {
+        memcpy(item, chan->buffer + chan->head * chan->item_size, chan->item_size);
+        if (++chan->head == chan->capacity)
+            chan->head = 0;
+        chan->count--;
+
+        if ((w = chan_take(&(chan->senders))) != NULL)
+        {
+            chan_push(chan, w->item);
+            chan_complete(w, 0);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if ((w = chan_take(&(chan->senders))) != NULL)
+    {
+        memcpy(item, w->item, chan->item_size);
+        chan_complete(w, 0);
+        return EXIT_SUCCESS;
+    }
+    return chan->closed ? EPIPE : EAGAIN;
+}
+
+/**
+ * @brief chan_try does the first operation ready, g_lock is held
+ * @return the index of the operation done, -1 if none is ready
+ */
+static int chan_try(thread_chan_op_t *ops, int nb)
+{
+    int i, err;
+    for (i = 0; i < nb; i++)
+    {
+        if (ops[i].chan == NULL)
+            continue;
+        err = (ops[i].dir == THREAD_CHAN_SEND) ? chan_send(ops[i].chan, ops[i].item) : chan_recv(ops[i].chan, ops[i].item);
+        if (err != EAGAIN)
+        {
+            ops[i].status = err;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief chan_wait sleeps on the channels of the operations until one of them is done, g_lock is held
+ * None of the operations is ready. The thread waking it up has done the operation
+ * @return the index of the operation done
+ */
+static int chan_wait(thread_chan_op_t *ops, int nb)
+{
+    struct chan_select select = { g_current_thread, -1, 0 };
+    struct chan_waiter waiters[nb];
+    int i;
+
+    for (i = 0; i < nb; i++)
+    {
+        if (ops[i].chan == NULL)
+            continue;
+        waiters[i].select = &select;
+        waiters[i].index = i;
+        waiters[i].item = ops[i].item;
+        TAILQ_INSERT_TAIL((ops[i].dir == THREAD_CHAN_SEND) ? &(ops[i].chan->senders) : &(ops[i].chan->receivers),
+                          &waiters[i], entries);
+    }
+    block(SWITCH_UNLOCK);
+
+    /* The operation done was taken out of its queue, the others are still in theirs */
+    LOCK();
+    for (i = 0; i < nb; i++)
+    {
+        if (ops[i].chan != NULL && i != select.done)
+            TAILQ_REMOVE((ops[i].dir == THREAD_CHAN_SEND) ? &(ops[i].chan->senders) : &(ops[i].chan->receivers),
+                         &waiters[i], entries);
+    }
+    ops[select.done].status = select.status;
+    return select.done;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                              User interface                                      ######
+ * ##############################################################################################
+ */
+
+int thread_chan_init(thread_chan_t *chan, unsigned int capacity, size_t item_size)
+{
+    if (item_size == 0)
+        return EINVAL;
+    chan->buffer = NULL;
+    if (capacity > 0 && (chan->buffer = malloc(capacity * item_size)) == NULL)
+        return ENOMEM;
+    chan->item_size = item_size;
+    chan->capacity = capacity;
+    chan->head = 0;
+    chan->count = 0;
+    chan->closed = 0;
+    TAILQ_INIT(&(chan->senders));
+    TAILQ_INIT(&(chan->receivers));
+    return EXIT_SUCCESS;
+}
+
+int thread_chan_destroy(thread_chan_t *chan)
+{
+    disable_interruptions();
+    LOCK();
+    int err = (!TAILQ_EMPTY(&(chan->senders)) || !TAILQ_EMPTY(&(chan->receivers))) ? EBUSY : EXIT_SUCCESS;
+    UNLOCK();
+    enable_interruptions();
+    if (err == EXIT_SUCCESS)
+        free(chan->buffer);
+    return err;
+}
+
+int thread_chan_close(thread_chan_t *chan)
+{
+    struct chan_waiter *w;
+
+    disable_interruptions();
+    LOCK();
+    int err = chan->closed ? EPIPE : EXIT_SUCCESS;
+    chan->closed = 1;
+    /* The receivers wait on an empty ring: there will be nothing more */
+    while ((w = chan_take(&(chan->receivers))) != NULL)
+        chan_complete(w, EPIPE);
+    while ((w = chan_take(&(chan->senders))) != NULL)
+        chan_complete(w, EPIPE);
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
+int thread_chan_send(thread_chan_t *chan, const void *item)
+{
+    thread_chan_op_t op = { chan, THREAD_CHAN_SEND, (void *) item, 0 };
+    thread_chan_select(&op, 1, 1);
+    return op.status;
+}
+
+int thread_chan_recv(thread_chan_t *chan, void *item)
+{
+    thread_chan_op_t op = { chan, THREAD_CHAN_RECV, item, 0 };
+    thread_chan_select(&op, 1, 1);
+    return op.status;
+}
+
+int thread_chan_send_batch(thread_chan_t *chan, const void *items, int nb)
+{
+    thread_chan_op_t op = { chan, THREAD_CHAN_SEND, NULL, 0 };
+    int i;
+
+    disable_interruptions();
+    LOCK();
+    /* Closed on the way: the items before it are sent, the caller knows how many */
+    for (i = 0; i < nb; i++)
+    {
+        op.item = (char *) items + i * chan->item_size;
+        if (chan_try(&op, 1) < 0)
+            chan_wait(&op, 1);
+        if (op.status != EXIT_SUCCESS)
+            break;
+    }
+    UNLOCK();
+    enable_interruptions();
+    return i;
+}
+
+int thread_chan_recv_batch(thread_chan_t *chan, void *items, int nb)
+{
+    thread_chan_op_t op = { chan, THREAD_CHAN_RECV, items, 0 };
+    int i = 0;
+
+    disable_interruptions();
+    LOCK();
+    /* Only the first one is waited for */
+    if (nb > 0 && chan_try(&op, 1) < 0)
+        chan_wait(&op, 1);
+    if (nb > 0 && op.status == EXIT_SUCCESS)
+    {
+        for (i = 1; i < nb; i++)
+        {
+            op.item = (char *) items + i * chan->item_size;
+            if (chan_try(&op, 1) < 0 || op.status != EXIT_SUCCESS)
+                break;
+        }
+    }
+    UNLOCK();
+    enable_interruptions();
+    return i;
+}
+
+int thread_chan_select(thread_chan_op_t *ops, int nb, int wait)
+{
+    int i, done;
+
+    disable_interruptions();
+    LOCK();
+    done = chan_try(ops, nb);
+    if (done < 0 && wait)
+    {
+        /* Nothing to wait for */
+        for (i = 0; i < nb && ops[i].chan == NULL; i++)
+            ;
+        if (i < nb)
+            done = chan_wait(ops, nb);
+    }
+    UNLOCK();
+    enable_interruptions();
+    return done;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,222 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "context.h"
+
+/**
+ * @brief stack_color gives the number of bytes left unused at the top of the stack of th
+ * The stacks are all aligned on a page: without it the registers saved by the switches would all
+ * fall in the same sets of the cache. It is taken from the address of the thread structure, so
+ * that the structures allocated one after the other get different colors
+ * @param th the thread
+ * @return a multiple of CACHE_LINE smaller than STACK_COLORS * CACHE_LINE
+ */
+static uintptr_t stack_color(thread *th)
+{
+    return ((uintptr_t) th / sizeof(thread)) % STACK_COLORS * CACHE_LINE;
+}
+
+#ifdef USE_ASM_SWITCH
+
+/*
+ * ##############################################################################################
+ * ######                          Register-only context switch                            ######
+ * ##############################################################################################
+ */
+
+/* switch_stack(void **from_sp, void *to_sp)
+ * Pushes the callee-saved registers on the current stack, stores the stack pointer in *from_sp,
+ * loads to_sp and pops the registers saved by the previous switch of the resumed thread.
+ * The signal mask is not touched: the scheduler always switches with the interruptions disabled.
+ *
+ * switch_trampoline is the return address of a new context: it calls entry(func, funcarg)
+ * with the values stored in the callee-saved registers by context_make.
+ */
+void switch_stack(void **from_sp, void *to_sp);
+void switch_trampoline(void);
+
+#if defined(__x86_64__)
+
+/* Frame saved on the stack (from the stack pointer):
+ * mxcsr | x87 cw, r15, r14, r13, r12, rbx, rbp, return address
+ */
+#define FRAME_WORDS 8
+#define FRAME_RBX 5
+#define FRAME_R12 4
+#define FRAME_R13 3
+#define FRAME_RET 7
+
+__asm__ (
+    ".text\n"
+    ".globl switch_stack\n"
+    ".hidden switch_stack\n"
+    ".type switch_stack,@function\n"
+    "switch_stack:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size switch_stack,.-switch_stack\n"
+    "\n"
+    ".globl switch_trampoline\n"
+    ".hidden switch_trampoline\n"
+    ".type switch_trampoline,@function\n"
+    "switch_trampoline:\n"
+    "    movq %r12, %rdi\n"
+    "    movq %r13, %rsi\n"
+    "    callq *%rbx\n"
+    "    ud2\n"
+    ".size switch_trampoline,.-switch_trampoline\n"
+);
+
+#elif defined(__aarch64__)
+
+/* Frame saved on the stack (from the stack pointer):
+ * x19 ... x28, x29 (fp), x30 (lr), d8 ... d15
+ */
+#define FRAME_WORDS 20
+#define FRAME_RBX 0 // x19
+#define FRAME_R12 1 // x20
+#define FRAME_R13 2 // x21
+#define FRAME_RET 11 // x30
+
+__asm__ (
+    ".text\n"
+    ".globl switch_stack\n"
+    ".hidden switch_stack\n"
+    ".type switch_stack,%function\n"
+    "switch_stack:\n"
+    "    sub sp, sp, #0xa0\n"
+    "    stp x19, x20, [sp, #0x00]\n"
+    "    stp x21, x22, [sp, #0x10]\n"
+    "    stp x23, x24, [sp, #0x20]\n"
+    "    stp x25, x26, [sp, #0x30]\n"
+    "    stp x27, x28, [sp, #0x40]\n"
+    "    stp x29, x30, [sp, #0x50]\n"
+    "    stp d8, d9, [sp, #0x60]\n"
+    "    stp d10, d11, [sp, #0x70]\n"
+    "    stp d12, d13, [sp, #0x80]\n"
+    "    stp d14, d15, [sp, #0x90]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0x00]\n"
+    "    ldp x21, x22, [sp, #0x10]\n"
+    "    ldp x23, x24, [sp, #0x20]\n"
+    "    ldp x25, x26, [sp, #0x30]\n"
+    "    ldp x27, x28, [sp, #0x40]\n"
+    "    ldp x29, x30, [sp, #0x50]\n"
+    "    ldp d8, d9, [sp, #0x60]\n"
+    "    ldp d10, d11, [sp, #0x70]\n"
+    "    ldp d12, d13, [sp, #0x80]\n"
+    "    ldp d14, d15, [sp, #0x90]\n"
+    "    add sp, sp, #0xa0\n"
+    "    ret\n"
+    ".size switch_stack,.-switch_stack\n"
+    "\n"
+    ".globl switch_trampoline\n"
+    ".hidden switch_trampoline\n"
+    ".type switch_trampoline,%function\n"
+    "switch_trampoline:\n"
+    "    mov x0, x20\n"
+    "    mov x1, x21\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size switch_trampoline,.-switch_trampoline\n"
+);
+
+#endif
+
+void context_make(thread *th, entry_function entry, void *(*func)(void *), void *funcarg)
+{
+    /* Top of the stack aligned on 16 bytes, one more word is left so that the trampoline
+     * is entered with the alignment expected after a call */
+    uintptr_t top = ((uintptr_t) th->stack + th->stack_size - stack_color(th)) & ~((uintptr_t) 15);
+#if defined(__x86_64__)
+    uintptr_t *frame = (uintptr_t *) (top - 2 * sizeof(uintptr_t)) - FRAME_WORDS;
+#else
+    uintptr_t *frame = (uintptr_t *) top - FRAME_WORDS;
+#endif
+    memset(frame, 0, FRAME_WORDS * sizeof(uintptr_t));
+#if defined(__x86_64__)
+    /* Default floating point control words */
+    ((uint32_t *) frame)[0] = 0x1F80;
+    ((uint32_t *) frame)[1] = 0x037F;
+#endif
+    frame[FRAME_RBX] = (uintptr_t) entry;
+    frame[FRAME_R12] = (uintptr_t) func;
+    frame[FRAME_R13] = (uintptr_t) funcarg;
+    frame[FRAME_RET] = (uintptr_t) switch_trampoline;
+    th->sp = frame;
+}
+
+void context_swap(thread *from, thread *to)
+{
+    /* A thread alone in the run queue yields to itself: to->sp is not saved yet */
+    if (from == to) return;
+    switch_stack(&from->sp, to->sp);
+}
+
+void context_set(thread *to)
+{
+    void *dead_sp;
+    switch_stack(&dead_sp, to->sp);
+    __builtin_unreachable();
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#else /* USE_ASM_SWITCH */
+
+/*
+ * ##############################################################################################
+ * ######                              ucontext fallback                                   ######
+ * ##############################################################################################
+ */
+
+void context_make(thread *th, entry_function entry, void *(*func)(void *), void *funcarg)
+{
+    getcontext(&th->ctx);
+    th->ctx.uc_stack.ss_sp = th->stack;
+    th->ctx.uc_stack.ss_size = th->stack_size - stack_color(th);
+    th->ctx.uc_link = NULL;
+    makecontext(&th->ctx, (void (*)(void)) entry, 2, func, funcarg);
+}
+
+void context_swap(thread *from, thread *to)
+{
+    CHECK(swapcontext(&from->ctx, &to->ctx), -1, "context_swap: swapcontext")
+}
+
+void context_set(thread *to)
+{
+    CHECK(setcontext(&to->ctx), -1, "context_set: setcontext")
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_ASM_SWITCH */
+
+#endif /* USE_PTHREAD */
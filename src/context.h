@@ -0,0 +1,42 @@
+/**
+  * \file context.h
+  * \brief low level context switching between threads
+  *
+  * With USE_ASM_SWITCH (x86-64 and AArch64 only) a switch only saves the callee-saved
+  * registers on the stack of the thread and stores its stack pointer in the thread
+  * structure: no syscall and no FPU state. Otherwise the ucontext functions are used.
+  */
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "define.h"
+
+/**
+ * @brief entry_function the first function executed by a new context
+ */
+typedef void (*entry_function)(void *(*)(void *), void *);
+
+/**
+ * @brief context_make prepares the context of th so that it starts by entry(func, funcarg)
+ * The stack of the thread (th->stack, th->stack_size) must already be allocated
+ * @param th the thread to initialize
+ * @param entry the function called when the context is first resumed, it must not return
+ * @param func first argument of entry
+ * @param funcarg second argument of entry
+ */
+void context_make(thread *th, entry_function entry, void *(*func)(void *), void *funcarg);
+
+/**
+ * @brief context_swap saves the context of from and resumes the context of to
+ * @param from the thread being left
+ * @param to the thread being resumed
+ */
+void context_swap(thread *from, thread *to);
+
+/**
+ * @brief context_set resumes the context of to without saving the current one
+ * @param to the thread being resumed
+ */
+void context_set(thread *to) __attribute__ ((__noreturn__));
+
+#endif // CONTEXT_H
@@ -6,13 +6,16 @@
 #define DEFINE_H
 
 // Includes
+#include "thread.h"
+#include "retval.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <ucontext.h>
 #include <errno.h>
-#include <sys/queue.h> // Using the singly linked tail queue STAILQ for runq
+#include <sys/queue.h> // STAILQ for the lists of threads, TAILQ for the FIFOs of the run queue
 #include <valgrind/valgrind.h>
 #include <sys/time.h>
+#include <time.h>
 #include <signal.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -21,10 +24,30 @@
 #include <unistd.h>
 
 #define CHECK(val, errval, msg) if ((val) == (errval)) {perror(msg); exit(EXIT_FAILURE);}
+#define CACHE_LINE 64 // the thread structures and the per-worker data are aligned on it
+#define BARRIER() __asm__ __volatile__ ("" ::: "memory") // the compiler must not move memory accesses across it
 
 #define TIMESLICE 4000 // 4 milliseconds in microseconds (Linux clock tick is 4 milliseconds)
-#define NB_PAGES 64 // the number of pages allocated for a thread stack
+#define TICK 1000 // period of the preemption timer in microseconds (rounded up to the clock tick by Linux)
+#define NB_PAGES 64 // the number of pages of a thread stack by default
+#define STACK_COLORS 32 // the top of the stacks is shifted by up to 31 cache lines, see context_make
+#define GUARD_PAGES 1 // the number of protected pages below each stack
 #define PAGE_SIZE sysconf(_SC_PAGE_SIZE)
+#define STACK_SIZE (NB_PAGES * PAGE_SIZE) // default size of a thread stack, without the guard pages
+#define STACK_MIN (4 * PAGE_SIZE) // the signal handlers run on the thread stack
+#ifndef POOL_WATERMARK
+#define POOL_WATERMARK 64 // the number of free stacks and thread structures kept for reuse
+#endif
+#define RECLAIM_BUDGET 2 // the number of exited threads an exiting thread frees, the others wait for an idle moment
+#define NB_PRIORITIES 10 // the priorities go from 1 to NB_PRIORITIES, one run queue for each
+#define AGING 32 // number of threads picked before a waiting lower priority is served anyway
+#define FAIR_WEIGHT 5 // priority whose virtual runtime goes at the speed of the real time (fair policy)
+#define WAKEUP_GRANULARITY 1000 // virtual runtime a woken thread must be behind the current one to preempt it (fair policy)
+#define IDLE_SPINS 64 // the number of sched_yield of an idle worker before it sleeps (USE_MN, USE_SHARDS)
+#define IDLE_SLEEP 100 // sleep of an idle worker between two polls in microseconds (USE_MN, USE_SHARDS)
+#define RING_SIZE 256 // the number of messages of a ring between two shards, power of 2 (USE_SHARDS)
+#define MUTEX_SPINS 100 // the number of checks of a locked mutex before parking (USE_MN)
+#define RWLOCK_READ_MAX 4 // the number of read holds of reader-writer locks a thread can have at a time
 
 // Values for status
 #define TO_FREE 2 /*! status for a thread which has terminated and its resources need to be free'd */
@@ -35,6 +58,26 @@
 
 #define SEGFAULT (void *) 0xdead
 
+// Both run the threads on several kernel threads (the workers)
+#if defined(USE_MN) && defined(USE_SHARDS)
+#error "USE_MN and USE_SHARDS cannot be used together"
+#endif
+#if defined(USE_MN) || defined(USE_SHARDS)
+#define USE_WORKERS
+#endif
+
+// With USE_SHARDS each worker has its own copy of the scheduler data
+#ifdef USE_SHARDS
+#define SHARD_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
+#else
+#define SHARD_LOCAL
+#endif
+
+// The register-only switch is only written for x86-64 and AArch64, the others use ucontext
+#if defined(USE_ASM_SWITCH) && !defined(__x86_64__) && !defined(__aarch64__)
+#undef USE_ASM_SWITCH
+#endif
+
 /*
  * ##############################################################################################
  * ######                                Structures                                        ######
@@ -53,22 +96,136 @@ typedef struct priority_t
 
 /**
   * \struct thread
+  * One allocation of whole cache lines: the first line holds what every switch and every run
+  * queue operation touches, the second one the data of the scheduling policies, the cold data
+  * (join, stack, name...) come after. The saved context of the ucontext switch is at the end.
   */
 typedef struct thread thread;
 typedef struct thread
 {
-    STAILQ_ENTRY(thread) runq_entries; /*!< entry for the runq */
-    STAILQ_ENTRY(thread) all_entries; /*!< entry for the all_threads queue */
-    STAILQ_ENTRY(thread) to_free_entries; /*!< entry for the to_free queue */
-    STAILQ_ENTRY(thread) mutex_queue_entries; /*!< this entry will be used by the mutex */
+    /* Hot: the switch and the run queue */
+#ifdef USE_ASM_SWITCH
+    void *sp; /*!< saved stack pointer, the registers are saved on the stack itself */
+#endif
+    TAILQ_ENTRY(thread) runq_entries; /*!< entry for a FIFO of the run queue, or for the pool */
+    struct runqueue *runq; /*!< the run queue holding the thread, NULL if it is not in one */
+    uint64_t timeslice_end; /*!< date in microseconds at which the thread must be preempted */
+    uint64_t run_start; /*!< date in microseconds at which the thread was last resumed */
+    uint64_t period; /*!< period of a periodic thread in microseconds, 0 otherwise (EDF) */
+    priority_t priority;
+    unsigned int level; /*!< FIFO of the run queue holding the thread (priority policy) */
+
+    /* Scheduling policies */
+    uint64_t heap_key __attribute__ ((aligned (CACHE_LINE))); /*!< the smallest key is at the root of the heap */
+    uint64_t vruntime; /*!< time run in microseconds, weighted by the priority (fair policy) */
+    thread *heap_left; /*!< children in a heap of the run queue, see runqueue.h */
+    thread *heap_right;
+    thread *heap_parent;
+    uint64_t rel_deadline; /*!< deadline of each job from the start of its period (EDF) */
+    uint64_t release; /*!< date at which the current job can start (EDF) */
+    uint64_t deadline; /*!< date at which the current job must be done (EDF) */
 
+    /* Cold */
+    STAILQ_ENTRY(thread) wait_entries __attribute__ ((aligned (CACHE_LINE))); /*!< entry for the sleep queue of a mutex, for the parking table, or for the to_free queue once exited */
+    const void *park_addr; /*!< the address the thread is parked on, see park.h */
+    uint64_t park_deadline; /*!< date at which a timed park gives up, 0 if the park is not timed */
+    TAILQ_ENTRY(thread) timed_entries; /*!< entry for the timed parks, by deadline */
+    unsigned short base_priority; /*!< priority given by the user, priority.value may be raised by priority inheritance */
+    unsigned short nb_inherit; /*!< number of mutexes with priority inheritance held */
+    struct thread_mutex *blocked_on; /*!< the mutex with priority inheritance the thread waits for, NULL otherwise */
+    struct thread_rwlock *read_held[RWLOCK_READ_MAX]; /*!< the reader-writer locks held for reading, once for each hold */
+    unsigned short nb_read_held;
+    int status; /*!< status of the thread; see macros above */
     thread *joinq; /*!< thread waiting to be joined */
-    struct retval *rv; /*!< return value of the thread after finishing */
-    ucontext_t *ctx; /*!< execution context */
+    struct retval rv; /*!< return value of the thread after finishing */
+    thread_t handle; /*!< identifier given to the user, NULL if the thread has none, see handle.h */
+    void *stack; /*!< base of the stack mapping of the thread, starting with the guard pages */
+    size_t stack_size; /*!< size of the stack mapping in bytes, guard pages included */
     int valgrind_stackid; /*!< nobody knew valgrind could be so complicated */
-    int status; /*!< status of the thread; see macros above */
-    priority_t priority;
-} thread;
+    int detached; /*!< THREAD_CREATE_DETACHED if nobody will join the thread */
+    unsigned int misses; /*!< number of jobs done after their deadline or skipped (EDF) */
+#ifdef USE_SHARDS
+    int shard; /*!< the shard running the thread, it never migrates */
+#endif
+    char name[THREAD_NAME_SIZE]; /*!< name given by the attributes */
+#ifndef USE_ASM_SWITCH
+    ucontext_t ctx __attribute__ ((aligned (CACHE_LINE))); /*!< execution context */
+#endif
+} __attribute__ ((aligned (CACHE_LINE))) thread;
+
+TAILQ_HEAD(thread_list_run, thread);
+STAILQ_HEAD(thread_list_free, thread);
+
+/**
+ * \struct runqueue the runnable threads, by deadline, then in the order of the policy, see runqueue.h
+ */
+struct runqueue
+{
+    int nb_ready; /*!< number of threads in the queue of the policy, periodic threads excluded */
+    struct thread_list_run fifo; /*!< the threads in FIFO order (fifo policy) */
+    struct thread_list_run levels[NB_PRIORITIES]; /*!< FIFO of the threads of priority i + 1 */
+    unsigned int bitmap; /*!< bit i is set if levels[i] is not empty (priority policy) */
+    unsigned int served[NB_PRIORITIES]; /*!< value of picks when levels[i] was last served or filled */
+    unsigned int picks; /*!< number of threads picked so far */
+    thread *fair_root; /*!< heap of the threads by virtual runtime (fair policy) */
+    thread *edf_root; /*!< heap of the released periodic threads by deadline */
+    thread *sleep_root; /*!< heap of the periodic threads waiting for their release, by release */
+    uint64_t min_vruntime; /*!< virtual runtime of the last thread picked (fair policy) */
+};
+
+#ifdef USE_WORKERS
+#include <pthread.h>
+
+/**
+ * \typedef spinlock a lock taken with the interruptions disabled, for short critical sections
+ */
+typedef volatile int spinlock;
+
+/**
+ * \struct message a thread to create on another shard (USE_SHARDS)
+ */
+typedef struct message
+{
+    void *(*func)(void *);
+    void *funcarg;
+} message;
+
+/**
+ * \struct ring a lock-free ring of messages with one producer and one consumer (USE_SHARDS)
+ * The indexes only increase, they are taken modulo RING_SIZE
+ */
+typedef struct ring
+{
+    unsigned int head __attribute__ ((aligned (CACHE_LINE))); /*!< next message to read, written by the consumer */
+    unsigned int tail __attribute__ ((aligned (CACHE_LINE))); /*!< next free slot, written by the producer */
+    message messages[RING_SIZE] __attribute__ ((aligned (CACHE_LINE)));
+} ring;
+
+/**
+  * \struct worker a kernel thread running the user threads (USE_MN, USE_SHARDS)
+  */
+typedef struct worker
+{
+#ifdef USE_MN
+    struct runqueue runq; /*!< run queue of the worker, the other workers steal from it */
+    spinlock runq_lock; /*!< protects runq */
+    thread *idle; /*!< runs while there is nothing to run, and steals threads from the other workers */
+    thread *prev; /*!< the thread left by the last switch of the worker */
+    int switch_actions; /*!< what the resumed thread must do with prev, see scheduler.h */
+#endif
+#ifdef USE_SHARDS
+    ring *inbox; /*!< one ring for each shard sending messages to this one */
+    unsigned int doorbell; /*!< incremented by the senders after each message */
+    unsigned int doorbell_seen; /*!< all the messages sent before it have been received */
+#endif
+    int id; /*!< index of the worker in g_workers */
+    pthread_t pthread; /*!< the kernel thread, except for the first worker */
+    timer_t timer; /*!< preemption timer of the kernel thread */
+    stack_t segv_stack; /*!< stack of the segfault handler of the kernel thread */
+} __attribute__ ((aligned (CACHE_LINE))) worker;
+
+worker *get_worker();
+#endif
 
 /*
  * ______________________________________________________________________________________________
@@ -80,36 +237,76 @@ typedef struct thread
  * ##############################################################################################
  */
 
+#ifdef USE_MN
+/* Each worker runs its own thread and has its own critical sections. The data read by a thread
+ * which may be preempted and resumed by another worker (see SCHED_LOCAL) are not in the worker */
+#define SCHED_LOCAL __thread __attribute__ ((tls_model ("initial-exec")))
+#define g_prev_thread (get_worker()->prev)
+#define g_switch_actions (get_worker()->switch_actions)
+#else
+#define SCHED_LOCAL SHARD_LOCAL
+/* With USE_SHARDS, the data below are thread-local: each worker has its own copy */
+
 /**
- * \var g_current_thread the thread that is currently being executed
+ * \var g_prev_thread the thread left by the last switch
  */
-thread * g_current_thread;
+extern SHARD_LOCAL thread * g_prev_thread;
 
 /**
- * \var g_all_threads the list of all the threads that were created
+ * \var g_switch_actions what the resumed thread must do with g_prev_thread, see scheduler.h
  */
-STAILQ_HEAD(thread_list_all, thread) g_all_threads;
+extern SHARD_LOCAL int g_switch_actions;
 
 /**
   * \var g_runq the run queue
   */
-STAILQ_HEAD(thread_list_run, thread) g_runq;
+extern SHARD_LOCAL struct runqueue g_runq;
+#endif
+
+/**
+ * \var g_current_thread the thread that is currently being executed (by the kernel thread with
+ * USE_WORKERS). With USE_MN it is read with one instruction relative to the thread pointer: a thread
+ * preempted between the load of get_worker() and the load of its field would read the current
+ * thread of the worker it left
+ */
+extern SCHED_LOCAL thread * g_current_thread;
+
+/**
+ * \var g_main_thread the thread of main (of the shard with USE_SHARDS), the other threads are found
+ * with their handles, see handle.h
+ */
+extern SHARD_LOCAL thread *g_main_thread;
 
 /**
  * \var g_to_free the to free queue
  */
-STAILQ_HEAD(thread_list_free, thread) g_to_free;
+extern SHARD_LOCAL struct thread_list_free g_to_free;
 
 /**
  * @brief set the signal set of the scheduler
  * Just SIGPROF in our case
  */
-sigset_t set;
+extern sigset_t set;
 
 /**
  * @brief segv_stack is the stack used for the sefgault signal
  */
-stack_t segv_stack;
+extern SHARD_LOCAL stack_t segv_stack;
+
+/**
+ * @brief g_in_scheduler is set while the scheduler data are modified (USE_SOFT_INTERRUPTIONS)
+ * The alarm handler does not preempt the thread then, it only sets g_preemption_pending. With USE_MN
+ * it is set by one store relative to the thread pointer, on the kernel thread running the store: a
+ * thread preempted between the load of get_worker() and the store would set the flag of the worker
+ * it left, and run its critical section preemptible
+ */
+extern SCHED_LOCAL volatile sig_atomic_t g_in_scheduler;
+
+/**
+ * @brief g_preemption_pending a timeslice expired during a critical section
+ * The preemption is done when leaving the critical section
+ */
+extern SCHED_LOCAL volatile sig_atomic_t g_preemption_pending;
 
 /*
  * ______________________________________________________________________________________________
@@ -0,0 +1,148 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "handle.h"
+#ifdef USE_SHARDS
+#include "worker.h"
+#endif
+
+/*
+ * ##############################################################################################
+ * ######                                Static data                                       ######
+ * ##############################################################################################
+ */
+
+#define HANDLE_MIN_SLOTS 64 // the number of slots of the table when the first thread is registered
+
+/**
+ * \struct slot a slot of the table of handles
+ */
+struct slot
+{
+    thread *th; /*!< the thread registered, NULL if the slot is free */
+    uint32_t generation; /*!< incremented each time the slot is released */
+    uint32_t next_free; /*!< index plus one of the next free slot, 0 for the last one */
+};
+
+/* With USE_SHARDS each shard has its own table */
+static SHARD_LOCAL struct slot *g_slots = NULL;
+static SHARD_LOCAL uint32_t g_nb_slots = 0; /* slots used at least once, the others are not initialized */
+static SHARD_LOCAL uint32_t g_size_slots = 0;
+static SHARD_LOCAL uint32_t g_first_free = 0; /* index plus one of the first free slot, 0 if none */
+static SHARD_LOCAL int g_nb_handles = 0;
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+void handle_init()
+{
+    g_slots = NULL;
+    g_nb_slots = 0;
+    g_size_slots = 0;
+    g_first_free = 0;
+    g_nb_handles = 0;
+}
+
+static uintptr_t shard_bits()
+{
+#ifdef USE_SHARDS
+    return (uintptr_t) (worker_id() & ((1 << HANDLE_SHARD_BITS) - 1)) << HANDLE_INDEX_BITS;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * ##############################################################################################
+ * ######                                  Handles                                         ######
+ * ##############################################################################################
+ */
+
+thread_t handle_alloc(thread *th)
+{
+    uint32_t index;
+    if (g_first_free != 0)
+    {
+        index = g_first_free - 1;
+        g_first_free = g_slots[index].next_free;
+    }
+    else
+    {
+        CHECK(g_nb_slots, (1u << HANDLE_INDEX_BITS) - 1, "handle_alloc: too many threads")
+        if (g_nb_slots == g_size_slots)
+        {
+            g_size_slots = g_size_slots ? 2 * g_size_slots : HANDLE_MIN_SLOTS;
+            g_slots = realloc(g_slots, g_size_slots * sizeof(struct slot));
+            CHECK(g_slots, NULL, "handle_alloc: realloc")
+        }
+        index = g_nb_slots++;
+        g_slots[index].generation = 0;
+    }
+
+    g_slots[index].th = th;
+    g_nb_handles++;
+    /* Shifted twice: the generation is dropped where a pointer has 32 bits */
+    th->handle = (thread_t) (((uintptr_t) g_slots[index].generation << 16 << 16) | shard_bits() | (index + 1));
+    return th->handle;
+}
+
+void handle_free(thread *th)
+{
+    if (th->handle == NULL)
+        return;
+
+    uint32_t index = ((uintptr_t) th->handle & ((1 << HANDLE_INDEX_BITS) - 1)) - 1;
+    g_slots[index].th = NULL;
+    g_slots[index].generation++;
+    g_slots[index].next_free = g_first_free;
+    g_first_free = index + 1;
+    g_nb_handles--;
+    th->handle = NULL;
+}
+
+thread *handle_get(thread_t handle)
+{
+    uintptr_t index = (uintptr_t) handle & ((1 << HANDLE_INDEX_BITS) - 1);
+    if (index == 0 || index > g_nb_slots)
+        return NULL;
+
+    /* The generation and the shard are checked with the whole handle */
+    thread *th = g_slots[index - 1].th;
+    if (th == NULL || th->handle != handle)
+        return NULL;
+    return th;
+}
+
+int handle_list(thread_t *handles, int size)
+{
+    int nb = 0;
+    for (uint32_t i = 0; i < g_nb_slots && nb < size; i++)
+    {
+        if (g_slots[i].th != NULL)
+            handles[nb++] = g_slots[i].th->handle;
+    }
+    return g_nb_handles;
+}
+
+void handle_for_each(void (*func)(thread *th), thread *skip)
+{
+    for (uint32_t i = 0; i < g_nb_slots; i++)
+    {
+        thread *th = g_slots[i].th;
+        if (th != NULL && th != skip)
+            func(th);
+    }
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+void handle_clear()
+{
+    free(g_slots);
+    handle_init();
+}
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,68 @@
+/**
+  * \file handle.h
+  * \brief the identifiers given to the user (thread_t), checked in O(1)
+  *
+  * The thread structures of a shard are registered in a dense table of slots. A handle is made of
+  * the index of the slot, the shard and the generation of the slot, which is incremented each time
+  * the slot is released: a handle of a thread already joined or free'd does not designate the
+  * thread reusing its slot (or its recycled structure), it designates no thread. The live threads
+  * are found by walking the table, without a list to keep up to date on each creation and join.
+  *
+  * With USE_MN the table is shared by the workers, all the functions are called with g_lock held.
+  * With USE_SHARDS each shard has its own table, the handle of a thread of another shard is unknown.
+  */
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include "define.h"
+
+#define HANDLE_INDEX_BITS 24 /*! bits of the index of the slot, plus one so that NULL is never a handle */
+#define HANDLE_SHARD_BITS 8 /*! bits of the shard, the generation takes the upper 32 bits */
+
+/**
+ * @brief handle_init initializes the empty table, before any thread is created
+ * With USE_SHARDS each shard has its own table: it is called by every shard
+ */
+void handle_init();
+
+/**
+ * @brief handle_alloc registers th in a free slot and sets th->handle
+ * @param th a thread structure which has no handle
+ * @return the handle of th
+ */
+thread_t handle_alloc(thread *th);
+
+/**
+ * @brief handle_free releases the slot of th, its handle does not designate it anymore
+ * @param th a thread structure, nothing is done if it has no handle (idle threads)
+ */
+void handle_free(thread *th);
+
+/**
+ * @brief handle_get gives the thread designated by a handle
+ * @param handle any value
+ * @return the thread, NULL if the handle was never given, is stale or belongs to another shard
+ */
+thread *handle_get(thread_t handle);
+
+/**
+ * @brief handle_list gives the handles of the threads registered, in the order of their slots
+ * @param handles receives at most size handles
+ * @param size the size of handles
+ * @return the number of threads registered, which may be greater than size
+ */
+int handle_list(thread_t *handles, int size);
+
+/**
+ * @brief handle_for_each calls func on each thread registered, which may release its own slot
+ * @param func the function
+ * @param skip a thread func is not called on, or NULL
+ */
+void handle_for_each(void (*func)(thread *th), thread *skip);
+
+/**
+ * @brief handle_clear frees the table, when the process (or the shard) ends
+ */
+void handle_clear();
+
+#endif // HANDLE_H
@@ -1,88 +1,714 @@
 #include "thread.h"
+
+#ifndef USE_PTHREAD
+#include <limits.h>
+#include <time.h>
 #include "define.h"
+#include "scheduler.h"
+#include "runqueue.h"
+#include "park.h"
+#include "handle.h"
+
+/*
+ * ##############################################################################################
+ * ######                                   Mutexes                                        ######
+ * ##############################################################################################
+ */
+
+// Values for the state of a mutex, the threads waiting for it are parked on the state
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1 /*! locked, no thread parked */
+#define MUTEX_CONTENDED 2 /*! locked, threads may be parked: the unlock wakes one up */
+
+/**
+ * @brief set_priority changes the priority the scheduler gives to a thread, g_lock is held
+ * A thread in the run queue is put back at the head of its new rank, the others are queued with it
+ * @param th the thread
+ * @param priority the new priority
+ */
+static void set_priority(thread *th, unsigned short priority)
+{
+    if (th->priority.value == priority)
+        return;
+    th->priority.value = priority;
+    if (th != g_current_thread && th->period == 0 && runq_remove(th) == EXIT_SUCCESS)
+        runq_push_head(th);
+}
+
+/**
+ * @brief mutex_inherit raises the possessor of a mutex to a priority, g_lock is held
+ * If the possessor waits for a mutex with priority inheritance itself, its possessor is raised too,
+ * and so on. The priorities only go up: a cycle of threads waiting for each other ends the walk.
+ * @param mutex a mutex with THREAD_MUTEX_INHERIT
+ * @param priority the priority of a thread waiting for it
+ */
+static void mutex_inherit(thread_mutex_t *mutex, unsigned short priority)
+{
+    thread *owner;
+    while (mutex != NULL && (owner = handle_get(mutex->possessor)) != NULL && owner->priority.value < priority)
+    {
+        set_priority(owner, priority);
+        mutex = owner->blocked_on;
+    }
+}
+
+/**
+ * @brief waiters_priority gives the highest priority of the threads parked on a mutex, g_lock is held
+ * @return the priority, 0 if no thread is parked
+ */
+static unsigned short waiters_priority(thread_mutex_t *mutex)
+{
+    unsigned short priority = 0;
+    thread *th = NULL;
+    while ((th = parked_next(&(mutex->state), th)) != NULL)
+        if (th->priority.value > priority)
+            priority = th->priority.value;
+    return priority;
+}
+
+/**
+ * @brief mutex_own makes a thread the possessor of a mutex, g_lock is held for THREAD_MUTEX_INHERIT
+ * With priority inheritance, the thread gets the priority of the threads still waiting
+ * @param mutex the mutex, just taken
+ * @param th the thread which took it
+ */
+static void mutex_own(thread_mutex_t *mutex, thread *th)
+{
+    mutex->possessor = th->handle;
+    if (mutex->kind & THREAD_MUTEX_INHERIT)
+    {
+        th->nb_inherit++;
+        mutex_inherit(mutex, waiters_priority(mutex));
+    }
+}
 
 /**
- * @brief thread_mutex_init initializes a mutex
- * @param mutex the mutex to initialize
- * @return EXIT_SUCCESS on success
+ * @brief mutex_disown leaves a mutex held by the current thread, g_lock is held for THREAD_MUTEX_INHERIT
+ * The priority given by the user comes back once no mutex with priority inheritance is held anymore
+ * @param mutex the mutex
  */
+static void mutex_disown(thread_mutex_t *mutex)
+{
+    thread *me = g_current_thread;
+    mutex->possessor = NULL;
+    if ((mutex->kind & THREAD_MUTEX_INHERIT) && --me->nb_inherit == 0)
+        set_priority(me, me->base_priority);
+}
+
 int thread_mutex_init(thread_mutex_t *mutex)
 {
+    return thread_mutex_init_kind(mutex, THREAD_MUTEX_BARGING);
+}
+
+int thread_mutex_init_kind(thread_mutex_t *mutex, int kind)
+{
+    int mode = kind & ~THREAD_MUTEX_INHERIT;
+    if (mode != THREAD_MUTEX_BARGING && mode != THREAD_MUTEX_HANDOFF)
+        return EINVAL;
+    mutex->state = MUTEX_UNLOCKED;
+    mutex->kind = kind;
     mutex->possessor = NULL;
-    STAILQ_INIT(&(mutex->sleep_queue));
     return EXIT_SUCCESS;
 }
 
+int thread_mutex_destroy(thread_mutex_t *mutex)
+{
+    if (mutex == DESTROYED_MUTEX)
+        return EINVAL;
+
+    disable_interruptions();
+    LOCK();
+    int err = (mutex->state != MUTEX_UNLOCKED || parked(&(mutex->state))) ? EBUSY : EXIT_SUCCESS;
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
 /**
- * @brief thread_mutex_destroy frees the mutex if possible
- * @param mutex the mutex to free
- * @return EXIT_FAILURE if the mutex is waited by others threads
- *         EXIT_SUCCESS on success
+ * @brief mutex_acquire waits until the mutex is available and takes it, g_lock is held and released
+ * A thread woken up by a barging release checks the mutex again here, with g_lock held: if it takes
+ * the mutex while other threads are parked, the unlock must wake the next one up.
+ * @param mutex the mutex
+ * @param deadline the date in microseconds (get_time) at which the wait gives up, 0 to wait forever
+ * @return 0 if the mutex is taken, ETIMEDOUT if the date has passed
  */
-int thread_mutex_destroy(thread_mutex_t *mutex)
+static int mutex_acquire(thread_mutex_t *mutex, uint64_t deadline)
 {
-    if (STAILQ_EMPTY(&(mutex->sleep_queue)))
+    for (;;)
     {
-        mutex = DESTROYED_MUTEX;
-        return EXIT_SUCCESS;
+        int state = mutex->state;
+        if (state == MUTEX_UNLOCKED)
+        {
+            int locked = parked(&(mutex->state)) ? MUTEX_CONTENDED : MUTEX_LOCKED;
+            if (__sync_bool_compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, locked))
+                break;
+        }
+        else if (state == MUTEX_CONTENDED
+                 || __sync_bool_compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_CONTENDED))
+        {
+            if (mutex->kind & THREAD_MUTEX_INHERIT)
+            {
+                g_current_thread->blocked_on = mutex;
+                mutex_inherit(mutex, g_current_thread->priority.value);
+            }
+            if (deadline == 0)
+                park(&(mutex->state));
+            else if (park_timed(&(mutex->state), deadline) == ETIMEDOUT)
+            {
+                /* The possessor keeps the priority inherited until it gives its mutexes back.
+                 * The state stays contended: the next unlock finds nobody and takes the slow path once */
+                LOCK();
+                g_current_thread->blocked_on = NULL;
+                UNLOCK();
+                return ETIMEDOUT;
+            }
+            /* Handed off: the unlock made me the possessor */
+            if (mutex->kind & THREAD_MUTEX_HANDOFF)
+                return EXIT_SUCCESS;
+            LOCK();
+            g_current_thread->blocked_on = NULL;
+        }
     }
-    else
-        return EXIT_FAILURE;
+    mutex_own(mutex, g_current_thread);
+    UNLOCK();
+    return EXIT_SUCCESS;
 }
 
 /**
- * @brief thread_mutex_lock locks the mutex for others threads, except the possessor
- * @param mutex the mutex to lock
- * @return EXIT_SUCCESS on success
- *         EXIT FAILURE if the mutex is destroyed
+ * @brief mutex_release makes a contended mutex available and wakes up the next thread parked, g_lock is held
+ * With THREAD_MUTEX_HANDOFF the thread woken up is the possessor, nobody can take the mutex before
+ * it runs. With THREAD_MUTEX_BARGING it competes with the threads arriving in the meantime.
+ * @param mutex the mutex, possessed by nobody
+ * @return the thread woken up, already in the run queue, NULL if none
  */
+static thread *mutex_release(thread_mutex_t *mutex)
+{
+    thread *next = unpark_one(&(mutex->state));
+    if (next != NULL && (mutex->kind & THREAD_MUTEX_HANDOFF))
+    {
+        next->blocked_on = NULL;
+        mutex_own(mutex, next);
+        __atomic_store_n(&(mutex->state), parked(&(mutex->state)) ? MUTEX_CONTENDED : MUTEX_LOCKED, __ATOMIC_RELEASE);
+    }
+    else
+        __atomic_store_n(&(mutex->state), MUTEX_UNLOCKED, __ATOMIC_RELEASE);
+    if (next != NULL)
+        runq_wake_head(next);
+    return next;
+}
+
+int thread_mutex_trylock(thread_mutex_t *mutex)
+{
+    if (mutex == DESTROYED_MUTEX)
+        return EINVAL;
+    /* The possessor must be known as soon as the mutex is locked, to be raised */
+    if (mutex->kind & THREAD_MUTEX_INHERIT)
+    {
+        disable_interruptions();
+        LOCK();
+        int err = EBUSY;
+        if (__sync_bool_compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED))
+        {
+            mutex_own(mutex, g_current_thread);
+            err = EXIT_SUCCESS;
+        }
+        UNLOCK();
+        enable_interruptions();
+        return err;
+    }
+    if (!__sync_bool_compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED))
+        return EBUSY;
+    mutex->possessor = g_current_thread->handle;
+    return EXIT_SUCCESS;
+}
+
 int thread_mutex_lock(thread_mutex_t *mutex)
 {
-    // Detecting destroyed mutex
     if (mutex == DESTROYED_MUTEX)
-        return EXIT_FAILURE;
+        return EINVAL;
 
-    /* Unavailable mutex : waiting for the mutex */
-    while (mutex->possessor != NULL)
+    /* Available: one compare-and-swap, in the critical section with priority inheritance */
+    if (!(mutex->kind & THREAD_MUTEX_INHERIT)
+        && __sync_bool_compare_and_swap(&(mutex->state), MUTEX_UNLOCKED, MUTEX_LOCKED))
     {
-        thread *me = thread_self();
-        STAILQ_INSERT_TAIL(&(mutex->sleep_queue), me, mutex_queue_entries);
-        thread *new_current = STAILQ_FIRST(&g_runq);
-        STAILQ_REMOVE_HEAD(&g_runq, runq_entries);
-        thread *tmp = g_current_thread;
-        g_current_thread = new_current;
-        CHECK(swapcontext(tmp->ctx, new_current->ctx), -1, "thread_mutex_lock: swapcontext")
+        mutex->possessor = g_current_thread->handle;
+        return EXIT_SUCCESS;
     }
-    /* Available mutex */
-    mutex->possessor = thread_self();
+    if (mutex->possessor == g_current_thread->handle)
+        return EDEADLK;
+
+#ifdef USE_MN
+    /* The possessor may be running on another worker and unlock soon: cheaper than parking */
+    int i;
+    for (i = 0; i < MUTEX_SPINS; i++)
+        if (__atomic_load_n(&(mutex->state), __ATOMIC_RELAXED) == MUTEX_UNLOCKED
+            && thread_mutex_trylock(mutex) == EXIT_SUCCESS)
+            return EXIT_SUCCESS;
+#endif
+
+    disable_interruptions();
+    LOCK();
+    mutex_acquire(mutex, 0);
+    enable_interruptions();
     return EXIT_SUCCESS;
 }
 
-/**
- * @brief thread_mutex_unlock unlocks the mutex is the thread is the possessor
- * @param mutex the mutex to unlock
- * @return EXIT_FAILURE if the mutex is destroyed or possessed by another thread
- *         EXIT_SUCCESS on success
- */
+int thread_mutex_timedlock(thread_mutex_t *mutex, const struct timespec *abstime)
+{
+    struct timespec now;
+    int64_t wait_ns;
+    int err;
+
+    if ((err = thread_mutex_trylock(mutex)) != EBUSY)
+        return err;
+    if (mutex->possessor == g_current_thread->handle)
+        return EDEADLK;
+
+    /* The date is given with CLOCK_REALTIME: the time left is converted to a date of get_time */
+    clock_gettime(CLOCK_REALTIME, &now);
+    wait_ns = (int64_t) (abstime->tv_sec - now.tv_sec) * 1000000000 + (abstime->tv_nsec - now.tv_nsec);
+    if (wait_ns <= 0)
+        return ETIMEDOUT;
+
+    disable_interruptions();
+    LOCK();
+    err = mutex_acquire(mutex, get_time() + (wait_ns + 999) / 1000);
+    enable_interruptions();
+    return err;
+}
+
 int thread_mutex_unlock(thread_mutex_t *mutex)
 {
-    // Detecting destroyed mutex
     if (mutex == DESTROYED_MUTEX)
-        return EXIT_FAILURE;
+        return EINVAL;
+    if (mutex->possessor != g_current_thread->handle)
+        return EPERM;
+
+    /* Nobody parked: one compare-and-swap. With priority inheritance the priority is given back in the critical section */
+    if (!(mutex->kind & THREAD_MUTEX_INHERIT))
+    {
+        mutex->possessor = NULL;
+        if (__sync_bool_compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_UNLOCKED))
+            return EXIT_SUCCESS;
+    }
+
+    disable_interruptions();
+    LOCK();
+    mutex_disown(mutex);
+    thread *next = NULL;
+    if (!__sync_bool_compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_UNLOCKED))
+        next = mutex_release(mutex);
+    /* Wake-up preemption: it runs right away, for the rest of my timeslice, if it goes before me */
+    if (next != NULL && (!runqueue_wake_preempts(next, g_current_thread) || runq_remove(next) != EXIT_SUCCESS))
+        next = NULL;
+    if (next != NULL)
+        switch_to(next, SWITCH_REQUEUE | SWITCH_UNLOCK | SWITCH_DONATE);
+    else
+        UNLOCK();
+    enable_interruptions();
+
+    return EXIT_SUCCESS;
+}
 
-    /* I'm not the possessor */
-    if (mutex->possessor != thread_self()) return EXIT_FAILURE;
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                             Condition variables                                  ######
+ * ##############################################################################################
+ */
+
+int thread_cond_init(thread_cond_t *cond)
+{
+    cond->mutex = NULL;
+    return EXIT_SUCCESS;
+}
 
-    /* I'm the possessor */
-    // Waking up the next thread waiting for the mutex */
-    if (!STAILQ_EMPTY(&(mutex->sleep_queue)))
+int thread_cond_destroy(thread_cond_t *cond)
+{
+    disable_interruptions();
+    LOCK();
+    int err = parked(cond) ? EBUSY : EXIT_SUCCESS;
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
+int thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex)
+{
+    disable_interruptions();
+    LOCK();
+    if (mutex->possessor != g_current_thread->handle)
     {
-        thread *next = STAILQ_FIRST(&(mutex->sleep_queue));
-        STAILQ_REMOVE_HEAD(&(mutex->sleep_queue), mutex_queue_entries);
-        STAILQ_INSERT_HEAD(&g_runq, next, runq_entries);
+        UNLOCK();
+        enable_interruptions();
+        return EPERM;
     }
-    // Get the mutex available
-    mutex->possessor = NULL;
 
+    /* Waiting for a signal, the mutex is released with g_lock held: no signal is lost */
+    cond->mutex = mutex;
+    mutex_disown(mutex);
+    if (!__sync_bool_compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_UNLOCKED))
+        mutex_release(mutex);
+    park(cond);
+
+    /* Woken up with the mutex available, or moved to the mutex and woken up by its unlock */
+    if (mutex->possessor != g_current_thread->handle)
+    {
+        LOCK();
+        mutex_acquire(mutex, 0);
+    }
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief cond_wake wakes up the threads waiting for a condition, g_lock is held
+ * A thread would only wait for the mutex once woken up: it is moved to the threads parked on the
+ * mutex instead, unless the mutex is available. It runs when the mutex is unlocked.
+ * @param cond the condition
+ * @param all 1 to wake up all the threads waiting (broadcast), 0 for the first one only
+ */
+static void cond_wake(thread_cond_t *cond, int all)
+{
+    thread_mutex_t *mutex = cond->mutex;
+    if (!parked(cond))
+        return;
+
+    for (;;)
+    {
+        int state = mutex->state;
+        /* The mutex is available: the first one takes it, the others are parked on the mutex */
+        if (state == MUTEX_UNLOCKED)
+        {
+            runq_wake(unpark_one(cond));
+            if (!all)
+                return;
+            break;
+        }
+        /* Locked: its unlock will wake up the threads moved */
+        if (state == MUTEX_CONTENDED
+            || __sync_bool_compare_and_swap(&(mutex->state), MUTEX_LOCKED, MUTEX_CONTENDED))
+            break;
+    }
+    /* The possessor runs with the priority of the threads moved */
+    if (park_requeue(cond, &(mutex->state), all ? -1 : 1) > 0 && (mutex->kind & THREAD_MUTEX_INHERIT))
+        mutex_inherit(mutex, waiters_priority(mutex));
+}
+
+int thread_cond_signal(thread_cond_t *cond)
+{
+    disable_interruptions();
+    LOCK();
+    cond_wake(cond, 0);
+    UNLOCK();
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+int thread_cond_broadcast(thread_cond_t *cond)
+{
+    disable_interruptions();
+    LOCK();
+    cond_wake(cond, 1);
+    UNLOCK();
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                             Reader-writer locks                                  ######
+ * ##############################################################################################
+ */
+
+int thread_rwlock_init(thread_rwlock_t *rwlock, int kind)
+{
+    if (kind != THREAD_RWLOCK_PREFER_READER && kind != THREAD_RWLOCK_PREFER_WRITER)
+        return EINVAL;
+    rwlock->readers = 0;
+    rwlock->writer = NULL;
+    rwlock->kind = kind;
+    STAILQ_INIT(&(rwlock->readers_queue));
+    STAILQ_INIT(&(rwlock->writers_queue));
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_destroy(thread_rwlock_t *rwlock)
+{
+    disable_interruptions();
+    LOCK();
+    int err = EXIT_SUCCESS;
+    if (rwlock->readers > 0 || rwlock->writer != NULL
+        || !STAILQ_EMPTY(&(rwlock->readers_queue)) || !STAILQ_EMPTY(&(rwlock->writers_queue)))
+        err = EBUSY;
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
+/**
+ * @brief read_hold finds a read hold of a lock by a thread, g_lock is held
+ * @return its index in th->read_held, -1 if the thread does not hold the lock for reading
+ */
+static int read_hold(thread *th, thread_rwlock_t *rwlock)
+{
+    int i;
+    for (i = 0; i < th->nb_read_held; i++)
+        if (th->read_held[i] == rwlock)
+            return i;
+    return -1;
+}
+
+/**
+ * @brief rwlock_handoff gives an available lock to the threads waiting for it, g_lock is held
+ * The threads woken up already hold the lock: the first writer waiting, or all the readers waiting
+ * at once (the readers are counted before they run, none of them checks the lock again).
+ * @param rwlock the lock, neither read nor written
+ */
+static void rwlock_handoff(thread_rwlock_t *rwlock)
+{
+    thread *next = STAILQ_FIRST(&(rwlock->writers_queue));
+    if (next != NULL && (rwlock->kind == THREAD_RWLOCK_PREFER_WRITER || STAILQ_EMPTY(&(rwlock->readers_queue))))
+    {
+        STAILQ_REMOVE_HEAD(&(rwlock->writers_queue), wait_entries);
+        rwlock->writer = next->handle;
+        runq_wake(next);
+        return;
+    }
+
+    /* Their room in read_held was checked before they waited */
+    while ((next = STAILQ_FIRST(&(rwlock->readers_queue))) != NULL)
+    {
+        STAILQ_REMOVE_HEAD(&(rwlock->readers_queue), wait_entries);
+        rwlock->readers++;
+        next->read_held[next->nb_read_held++] = rwlock;
+        runq_wake(next);
+    }
+}
+
+int thread_rwlock_rdlock(thread_rwlock_t *rwlock)
+{
+    disable_interruptions();
+    LOCK();
+    thread *me = g_current_thread;
+    int err = (rwlock->writer == thread_self()) ? EDEADLK : EXIT_SUCCESS;
+    if (err == EXIT_SUCCESS && me->nb_read_held == RWLOCK_READ_MAX)
+        err = EAGAIN;
+    if (err != EXIT_SUCCESS)
+    {
+        UNLOCK();
+        enable_interruptions();
+        return err;
+    }
+
+    /* With the writer preference, a writer waiting goes before the readers arriving, but not before
+     * a reader taking the lock again: the writer waits for it */
+    if (rwlock->writer == NULL
+        && (rwlock->kind == THREAD_RWLOCK_PREFER_READER || STAILQ_EMPTY(&(rwlock->writers_queue))
+            || read_hold(me, rwlock) >= 0))
+    {
+        rwlock->readers++;
+        me->read_held[me->nb_read_held++] = rwlock;
+        UNLOCK();
+    }
+    else
+    {
+        /* Woken up by rwlock_handoff, holding the lock */
+        STAILQ_INSERT_TAIL(&(rwlock->readers_queue), me, wait_entries);
+        block(SWITCH_UNLOCK);
+    }
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+int thread_rwlock_wrlock(thread_rwlock_t *rwlock)
+{
+    disable_interruptions();
+    LOCK();
+    /* Held for reading by me: the writer would wait for itself */
+    if (rwlock->writer == thread_self() || read_hold(g_current_thread, rwlock) >= 0)
+    {
+        UNLOCK();
+        enable_interruptions();
+        return EDEADLK;
+    }
+
+    if (rwlock->writer == NULL && rwlock->readers == 0)
+    {
+        rwlock->writer = thread_self();
+        UNLOCK();
+    }
+    else
+    {
+        /* Woken up by rwlock_handoff, holding the lock */
+        STAILQ_INSERT_TAIL(&(rwlock->writers_queue), g_current_thread, wait_entries);
+        block(SWITCH_UNLOCK);
+    }
+    enable_interruptions();
     return EXIT_SUCCESS;
 }
+
+int thread_rwlock_unlock(thread_rwlock_t *rwlock)
+{
+    int i;
+
+    disable_interruptions();
+    LOCK();
+    thread *me = g_current_thread;
+    if (rwlock->writer == thread_self())
+        rwlock->writer = NULL;
+    else if ((i = read_hold(me, rwlock)) >= 0)
+    {
+        me->read_held[i] = me->read_held[--me->nb_read_held];
+        rwlock->readers--;
+    }
+    else
+    {
+        UNLOCK();
+        enable_interruptions();
+        return EPERM;
+    }
+
+    if (rwlock->readers == 0)
+        rwlock_handoff(rwlock);
+    UNLOCK();
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                 Semaphores                                       ######
+ * ##############################################################################################
+ */
+
+int thread_sem_init(thread_sem_t *sem, unsigned int value)
+{
+    if (value > INT_MAX)
+        return EINVAL;
+    sem->value = value;
+    return EXIT_SUCCESS;
+}
+
+int thread_sem_destroy(thread_sem_t *sem)
+{
+    disable_interruptions();
+    LOCK();
+    int err = parked(&(sem->value)) ? EBUSY : EXIT_SUCCESS;
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
+int thread_sem_trywait(thread_sem_t *sem)
+{
+    int value;
+    while ((value = sem->value) > 0)
+        if (__sync_bool_compare_and_swap(&(sem->value), value, value - 1))
+            return EXIT_SUCCESS;
+    return EAGAIN;
+}
+
+int thread_sem_wait(thread_sem_t *sem)
+{
+    if (thread_sem_trywait(sem) == EXIT_SUCCESS)
+        return EXIT_SUCCESS;
+
+    disable_interruptions();
+    LOCK();
+    /* Checked again with g_lock held: a post sees me parked, or I see its unit */
+    if (thread_sem_trywait(sem) == EXIT_SUCCESS)
+        UNLOCK();
+    else
+        park(&(sem->value)); /* Woken up with the unit of the post */
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+int thread_sem_post(thread_sem_t *sem)
+{
+    disable_interruptions();
+    LOCK();
+    /* Handed to the first thread waiting: the value only grows while nobody waits, so a thread
+     * arriving in the meantime cannot take the unit before it */
+    thread *next = unpark_one(&(sem->value));
+    if (next != NULL)
+        runq_wake(next);
+    else
+        __sync_fetch_and_add(&(sem->value), 1);
+    UNLOCK();
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                 Wait groups                                      ######
+ * ##############################################################################################
+ */
+
+int thread_waitgroup_init(thread_waitgroup_t *wg)
+{
+    wg->count = 0;
+    return EXIT_SUCCESS;
+}
+
+int thread_waitgroup_destroy(thread_waitgroup_t *wg)
+{
+    disable_interruptions();
+    LOCK();
+    int err = parked(&(wg->count)) ? EBUSY : EXIT_SUCCESS;
+    UNLOCK();
+    enable_interruptions();
+    return err;
+}
+
+int thread_waitgroup_add(thread_waitgroup_t *wg, int delta)
+{
+    int count;
+    do
+    {
+        count = wg->count;
+        if (count + delta < 0)
+            return EINVAL;
+    } while (!__sync_bool_compare_and_swap(&(wg->count), count, count + delta));
+
+    /* The last one done wakes up all the threads waiting, once */
+    if (count + delta == 0 && delta != 0)
+        thread_wake(&(wg->count), INT_MAX);
+    return EXIT_SUCCESS;
+}
+
+int thread_waitgroup_done(thread_waitgroup_t *wg)
+{
+    return thread_waitgroup_add(wg, -1);
+}
+
+int thread_waitgroup_wait(thread_waitgroup_t *wg)
+{
+    int count;
+    while ((count = wg->count) != 0)
+        thread_wait_on(&(wg->count), count);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,252 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include <stdint.h>
+#include <errno.h>
+#include "park.h"
+#include "scheduler.h"
+
+/*
+ * ##############################################################################################
+ * ######                                Static data                                       ######
+ * ##############################################################################################
+ */
+
+/* The threads parked, whatever their address, in the queue of the hash of their address */
+STAILQ_HEAD(thread_list_park, thread);
+
+/* With USE_SHARDS each shard has its own table */
+static SHARD_LOCAL struct thread_list_park g_buckets[PARK_BUCKETS];
+
+/* The timed parks by deadline, and the deadline of the first one (0 if none) read without g_lock */
+static SHARD_LOCAL TAILQ_HEAD(thread_list_timed, thread) g_timed;
+static SHARD_LOCAL uint64_t g_next_deadline;
+
+/**
+ * @brief bucket gives the queue of the threads parked on an address
+ * Multiplicative hash: the low bits of the addresses of the words, always the same, are mixed up
+ */
+static struct thread_list_park *bucket(const void *addr)
+{
+    return &g_buckets[((uintptr_t) addr * 0x9E3779B97F4A7C15ULL) >> (64 - PARK_BITS)];
+}
+
+/**
+ * @brief untime removes a thread woken up from the timed parks, if its park is timed
+ */
+static void untime(thread *th)
+{
+    if (th->park_deadline == 0)
+        return;
+    TAILQ_REMOVE(&g_timed, th, timed_entries);
+    th->park_deadline = 0;
+    thread *first = TAILQ_FIRST(&g_timed);
+    __atomic_store_n(&g_next_deadline, (first != NULL) ? first->park_deadline : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief take removes the first thread parked on addr from its queue, its timed park is kept
+ * @return the thread, NULL if none is parked on addr
+ */
+static thread *take(const void *addr)
+{
+    struct thread_list_park *queue = bucket(addr);
+    thread *th;
+
+    STAILQ_FOREACH(th, queue, wait_entries)
+    {
+        if (th->park_addr == addr)
+        {
+            STAILQ_REMOVE(queue, th, thread, wait_entries);
+            th->park_addr = NULL;
+            return th;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                  Parking                                         ######
+ * ##############################################################################################
+ */
+
+void park_init()
+{
+    int i;
+    for (i = 0; i < PARK_BUCKETS; i++)
+        STAILQ_INIT(&g_buckets[i]);
+    TAILQ_INIT(&g_timed);
+    g_next_deadline = 0;
+}
+
+void park(const void *addr)
+{
+    thread *me = g_current_thread;
+    me->park_addr = addr;
+    me->park_deadline = 0;
+    STAILQ_INSERT_TAIL(bucket(addr), me, wait_entries);
+    block(SWITCH_UNLOCK);
+}
+
+int park_timed(const void *addr, uint64_t deadline)
+{
+    thread *me = g_current_thread;
+    thread *th;
+
+    if (deadline <= get_time())
+    {
+        UNLOCK();
+        return ETIMEDOUT;
+    }
+    me->park_addr = addr;
+    me->park_deadline = deadline;
+    STAILQ_INSERT_TAIL(bucket(addr), me, wait_entries);
+
+    /* Behind the parks of the same date: few threads wait with a date, the walk is short */
+    TAILQ_FOREACH_REVERSE(th, &g_timed, thread_list_timed, timed_entries)
+        if (th->park_deadline <= deadline)
+            break;
+    if (th != NULL)
+        TAILQ_INSERT_AFTER(&g_timed, th, me, timed_entries);
+    else
+        TAILQ_INSERT_HEAD(&g_timed, me, timed_entries);
+    __atomic_store_n(&g_next_deadline, TAILQ_FIRST(&g_timed)->park_deadline, __ATOMIC_RELAXED);
+    block(SWITCH_UNLOCK);
+
+    /* park_expire leaves the date set: the thread was not woken up by the word */
+    if (me->park_deadline == 0)
+        return EXIT_SUCCESS;
+    me->park_deadline = 0;
+    return ETIMEDOUT;
+}
+
+void park_expire(uint64_t now)
+{
+    thread *th;
+    while ((th = TAILQ_FIRST(&g_timed)) != NULL && th->park_deadline <= now)
+    {
+        TAILQ_REMOVE(&g_timed, th, timed_entries);
+        STAILQ_REMOVE(bucket(th->park_addr), th, thread, wait_entries);
+        th->park_addr = NULL;
+        runq_wake(th);
+    }
+    __atomic_store_n(&g_next_deadline, (th != NULL) ? th->park_deadline : 0, __ATOMIC_RELAXED);
+}
+
+uint64_t park_next_deadline()
+{
+    return __atomic_load_n(&g_next_deadline, __ATOMIC_RELAXED);
+}
+
+thread *unpark_one(const void *addr)
+{
+    thread *th = take(addr);
+    if (th != NULL)
+        untime(th);
+    return th;
+}
+
+int unpark(const void *addr, int nb)
+{
+    struct thread_list_park *queue = bucket(addr);
+    struct thread_list_park others = STAILQ_HEAD_INITIALIZER(others);
+    thread *th;
+    int nb_woken = 0;
+
+    /* The threads parked on other addresses are put back in the same order */
+    while ((nb < 0 || nb_woken < nb) && (th = STAILQ_FIRST(queue)) != NULL)
+    {
+        STAILQ_REMOVE_HEAD(queue, wait_entries);
+        if (th->park_addr == addr)
+        {
+            th->park_addr = NULL;
+            untime(th);
+            runq_wake(th);
+            nb_woken++;
+        }
+        else
+            STAILQ_INSERT_TAIL(&others, th, wait_entries);
+    }
+    STAILQ_CONCAT(&others, queue);
+    STAILQ_CONCAT(queue, &others);
+    return nb_woken;
+}
+
+int park_requeue(const void *from, const void *to, int nb)
+{
+    thread *th;
+    int nb_moved = 0;
+
+    /* In their order: they are behind the threads already parked on to, with the same date */
+    while ((nb < 0 || nb_moved < nb) && (th = take(from)) != NULL)
+    {
+        th->park_addr = to;
+        STAILQ_INSERT_TAIL(bucket(to), th, wait_entries);
+        nb_moved++;
+    }
+    return nb_moved;
+}
+
+int parked(const void *addr)
+{
+    thread *th;
+    STAILQ_FOREACH(th, bucket(addr), wait_entries)
+        if (th->park_addr == addr)
+            return 1;
+    return 0;
+}
+
+thread *parked_next(const void *addr, thread *th)
+{
+    th = (th == NULL) ? STAILQ_FIRST(bucket(addr)) : STAILQ_NEXT(th, wait_entries);
+    while (th != NULL && th->park_addr != addr)
+        th = STAILQ_NEXT(th, wait_entries);
+    return th;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                              User interface                                      ######
+ * ##############################################################################################
+ */
+
+int thread_wait_on(const int *addr, int expected)
+{
+    disable_interruptions();
+    LOCK();
+    /* Changed before I could park: the wake-up may already be given */
+    if (*(volatile const int *) addr != expected)
+    {
+        UNLOCK();
+        enable_interruptions();
+        return EAGAIN;
+    }
+    park(addr);
+    enable_interruptions();
+    return EXIT_SUCCESS;
+}
+
+int thread_wake(const int *addr, int nb)
+{
+    disable_interruptions();
+    LOCK();
+    int nb_woken = unpark(addr, nb);
+    UNLOCK();
+    enable_interruptions();
+    return nb_woken;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,97 @@
+/**
+  * \file park.h
+  * \brief the parking table: the threads sleeping until a word changes, found by its address
+  *
+  * A thread parks on the address of a word only if the word still has the value it expects, checked
+  * with the table locked, so that a wake-up given after the word was changed is never lost. The
+  * threads parked are kept in PARK_BUCKETS queues, by hash of the address: a synchronization object
+  * needs no queue of its own, only a word.
+  *
+  * A timed park also gives up at a date: the timed parks are kept by deadline, and the threads whose
+  * date has passed are woken up by the tick, thread_yield and the idle loops, see park_expire.
+  *
+  * With USE_MN the table is shared by the workers, all the functions are called with g_lock held.
+  * With USE_SHARDS each shard has its own table, a thread is only woken up by the threads of its shard.
+  */
+#ifndef PARK_H
+#define PARK_H
+
+#include "define.h"
+
+#define PARK_BITS 8 /*! log2 of the number of queues of the table */
+#define PARK_BUCKETS (1 << PARK_BITS)
+
+/**
+ * @brief park_init initializes the empty table, before any thread parks
+ * With USE_SHARDS each shard has its own table: it is called by every shard
+ */
+void park_init();
+
+/**
+ * @brief park puts the current thread to sleep on addr and releases g_lock
+ * @param addr the address of the word waited for
+ */
+void park(const void *addr);
+
+/**
+ * @brief park_timed puts the current thread to sleep on addr until it is woken up or the date has
+ * passed, and releases g_lock
+ * @param addr the address of the word waited for
+ * @param deadline the date in microseconds (get_time)
+ * @return 0 if the thread was woken up, ETIMEDOUT if the date has passed
+ */
+int park_timed(const void *addr, uint64_t deadline);
+
+/**
+ * @brief park_expire wakes up the threads whose timed park has passed its date
+ * @param now the current date in microseconds
+ */
+void park_expire(uint64_t now);
+
+/**
+ * @brief park_next_deadline gives the date of the first timed park to give up
+ * It can be called without g_lock, as a hint
+ * @return the date in microseconds, 0 if no park is timed
+ */
+uint64_t park_next_deadline();
+
+/**
+ * @brief unpark_one removes the first thread parked on addr from the table, without waking it up
+ * @param addr the address of the word
+ * @return the thread, NULL if none is parked on addr
+ */
+thread *unpark_one(const void *addr);
+
+/**
+ * @brief unpark wakes up the first threads parked on addr, in the order they parked
+ * @param addr the address of the word
+ * @param nb the maximum number of threads to wake up, negative for all of them
+ * @return the number of threads woken up
+ */
+int unpark(const void *addr, int nb);
+
+/**
+ * @brief park_requeue moves the threads parked on from to the queue of to, without waking them up
+ * @param from the address of the word they are parked on
+ * @param to the address of the word they will be parked on
+ * @param nb the maximum number of threads to move, negative for all of them
+ * @return the number of threads moved
+ */
+int park_requeue(const void *from, const void *to, int nb);
+
+/**
+ * @brief parked tells if threads are parked on addr
+ * @param addr the address of the word
+ * @return 1 if at least one thread is parked on addr, 0 otherwise
+ */
+int parked(const void *addr);
+
+/**
+ * @brief parked_next walks the threads parked on addr, in the order they parked
+ * @param addr the address of the word
+ * @param th a thread parked on addr, NULL for the first one
+ * @return the thread parked on addr after th, NULL if there is none
+ */
+thread *parked_next(const void *addr, thread *th);
+
+#endif // PARK_H
@@ -0,0 +1,157 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "pool.h"
+#include "handle.h"
+
+/*
+ * ##############################################################################################
+ * ######                                Static data                                       ######
+ * ##############################################################################################
+ */
+
+/**
+ * \struct pooled_stack a stack of STACK_SIZE bytes waiting to be reused, still registered to valgrind
+ */
+struct pooled_stack
+{
+    void *stack;
+    int valgrind_stackid;
+};
+
+/* With USE_SHARDS each shard has its own pools */
+static SHARD_LOCAL struct pooled_stack g_stack_pool[POOL_WATERMARK];
+static SHARD_LOCAL int g_nb_pooled_stacks = 0;
+
+static SHARD_LOCAL TAILQ_HEAD(thread_list_pool, thread) g_thread_pool;
+static SHARD_LOCAL int g_nb_pooled_threads = 0;
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+void pool_init()
+{
+    TAILQ_INIT(&g_thread_pool);
+    g_nb_pooled_threads = 0;
+    g_nb_pooled_stacks = 0;
+}
+
+/*
+ * ##############################################################################################
+ * ######                              Thread structures                                   ######
+ * ##############################################################################################
+ */
+
+thread *pool_get_thread()
+{
+    thread *th = TAILQ_FIRST(&g_thread_pool);
+    if (th != NULL)
+    {
+        TAILQ_REMOVE(&g_thread_pool, th, runq_entries);
+        g_nb_pooled_threads--;
+        return th;
+    }
+
+    /* One allocation of whole cache lines, its context and its return value included */
+    th = aligned_alloc(CACHE_LINE, sizeof(thread));
+    CHECK(th, NULL, "pool_get_thread: thread aligned_alloc")
+    th->handle = NULL;
+    return th;
+}
+
+void pool_put_thread(thread *th)
+{
+    /* Its handle must not designate the next thread using the structure */
+    handle_free(th);
+    if (g_nb_pooled_threads < POOL_WATERMARK)
+    {
+        TAILQ_INSERT_HEAD(&g_thread_pool, th, runq_entries);
+        g_nb_pooled_threads++;
+    }
+    else
+    {
+        free(th);
+    }
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                   Stacks                                         ######
+ * ##############################################################################################
+ */
+
+void pool_get_stack(thread *th, size_t stack_size)
+{
+    th->stack_size = stack_size + GUARD_PAGES * PAGE_SIZE;
+    if (stack_size == STACK_SIZE && g_nb_pooled_stacks > 0)
+    {
+        g_nb_pooled_stacks--;
+        th->stack = g_stack_pool[g_nb_pooled_stacks].stack;
+        th->valgrind_stackid = g_stack_pool[g_nb_pooled_stacks].valgrind_stackid;
+        return;
+    }
+
+    /* No swap space is reserved: the pages are only committed when touched */
+    th->stack = mmap(NULL, th->stack_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    CHECK(th->stack, MAP_FAILED, "pool_get_stack: mmap")
+    th->valgrind_stackid = VALGRIND_STACK_REGISTER(th->stack, th->stack + th->stack_size);
+    /* Guard pages: a stack overflow raises a SIGSEGV */
+    CHECK(mprotect(th->stack, GUARD_PAGES * PAGE_SIZE, PROT_NONE), -1, "pool_get_stack: mprotect")
+}
+
+static void free_stack(void *stack, size_t stack_size, int valgrind_stackid)
+{
+    VALGRIND_STACK_DEREGISTER(valgrind_stackid);
+    CHECK(munmap(stack, stack_size), -1, "free_stack: munmap")
+}
+
+int pool_keep_stack(thread *th)
+{
+    if (th->stack_size != STACK_SIZE + GUARD_PAGES * PAGE_SIZE || g_nb_pooled_stacks >= POOL_WATERMARK)
+        return EXIT_FAILURE;
+
+    g_stack_pool[g_nb_pooled_stacks].stack = th->stack;
+    g_stack_pool[g_nb_pooled_stacks].valgrind_stackid = th->valgrind_stackid;
+    g_nb_pooled_stacks++;
+    th->stack = NULL;
+    return EXIT_SUCCESS;
+}
+
+void pool_put_stack(thread *th)
+{
+    if (pool_keep_stack(th) == EXIT_FAILURE)
+    {
+        free_stack(th->stack, th->stack_size, th->valgrind_stackid);
+        th->stack = NULL;
+    }
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+void pool_clear()
+{
+    while (g_nb_pooled_stacks > 0)
+    {
+        g_nb_pooled_stacks--;
+        free_stack(g_stack_pool[g_nb_pooled_stacks].stack, STACK_SIZE + GUARD_PAGES * PAGE_SIZE,
+                   g_stack_pool[g_nb_pooled_stacks].valgrind_stackid);
+    }
+
+    thread *th;
+    while ((th = TAILQ_FIRST(&g_thread_pool)) != NULL)
+    {
+        TAILQ_REMOVE(&g_thread_pool, th, runq_entries);
+        free(th);
+    }
+    g_nb_pooled_threads = 0;
+}
+
+#endif /* USE_PTHREAD */
@@ -0,0 +1,61 @@
+/**
+  * \file pool.h
+  * \brief recycling of the thread structures and of the stacks
+  *
+  * The stacks are kept with their guard pages protected and the thread structures with their
+  * return value (and context), so that creating a thread after the warm-up makes no allocation
+  * and no syscall. At most POOL_WATERMARK items of each kind are kept, the others are free'd.
+  */
+#ifndef POOL_H
+#define POOL_H
+
+#include "define.h"
+
+/**
+ * @brief pool_init initializes the empty pools, before any other function
+ * With USE_SHARDS each shard has its own pools: it is called by every shard
+ */
+void pool_init();
+
+/**
+ * @brief pool_get_thread gives a thread structure
+ * @return a recycled thread structure, or a new one if the pool is empty
+ */
+thread *pool_get_thread();
+
+/**
+ * @brief pool_put_thread gives back a thread structure once it has been joined, its handle is released
+ * @param th the thread structure, its stack must have been given back already
+ */
+void pool_put_thread(thread *th);
+
+/**
+ * @brief pool_get_stack sets the stack of th (stack, stack_size and valgrind_stackid)
+ * The stack is reserved with mmap, only the pages touched by the thread are committed.
+ * The guard pages at the bottom of the stack are already protected.
+ * Only the stacks of STACK_SIZE bytes are recycled.
+ * @param th the thread that needs a stack
+ * @param stack_size the usable size of the stack, multiple of the page size
+ */
+void pool_get_stack(thread *th, size_t stack_size);
+
+/**
+ * @brief pool_put_stack gives back the stack of th once the thread has exited
+ * @param th the thread whose stack is not used anymore
+ */
+void pool_put_stack(thread *th);
+
+/**
+ * @brief pool_keep_stack puts the stack of th in the pool only if the pool can keep it
+ * The stack is never unmapped, so an exiting thread can give back its own stack before switching
+ * @param th the thread whose stack is not used anymore after the next switch
+ * @return EXIT_SUCCESS if the stack has been kept, EXIT_FAILURE if the pool is full
+ */
+int pool_keep_stack(thread *th);
+
+/**
+ * @brief pool_clear frees all the thread structures and stacks kept in the pools
+ */
+void pool_clear();
+
+#endif // POOL_H
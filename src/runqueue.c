@@ -0,0 +1,563 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "runqueue.h"
+#include "scheduler.h"
+
+/*
+ * ##############################################################################################
+ * ######                                   Heaps                                          ######
+ * ##############################################################################################
+ */
+
+/**
+ * @brief heap_merge merges two skew heaps by heap_key, a goes first when the keys are equal
+ * Top-down: the children of each node of the merge path are swapped, no recursion
+ * @return the root of the heap, its heap_parent is NULL
+ */
+static thread *heap_merge(thread *a, thread *b)
+{
+    thread *root = NULL;
+    thread *parent = NULL;
+    thread **link = &root;
+    while (a != NULL && b != NULL)
+    {
+        if (b->heap_key < a->heap_key)
+        {
+            thread *tmp = a;
+            a = b;
+            b = tmp;
+        }
+        /* The rest is merged in the left child, the right one takes the previous left child */
+        *link = a;
+        a->heap_parent = parent;
+        parent = a;
+        link = &a->heap_left;
+        thread *right = a->heap_right;
+        a->heap_right = a->heap_left;
+        a = right;
+    }
+    *link = (a != NULL) ? a : b;
+    if (*link != NULL)
+        (*link)->heap_parent = parent;
+    return root;
+}
+
+/**
+ * @brief heap_push puts th in a heap, its heap_key must be set
+ * @param head th goes before the threads of the same key
+ */
+static void heap_push(thread **root, thread *th, int head)
+{
+    th->heap_left = NULL;
+    th->heap_right = NULL;
+    if (head)
+        *root = heap_merge(th, *root);
+    else
+        *root = heap_merge(*root, th);
+}
+
+static thread *heap_take(thread **root)
+{
+    thread *th = *root;
+    *root = heap_merge(th->heap_left, th->heap_right);
+    return th;
+}
+
+/**
+ * @brief heap_remove removes th from the heap of root, wherever it is
+ */
+static void heap_remove(thread **root, thread *th)
+{
+    thread *parent = th->heap_parent;
+    thread **link = root;
+    if (parent != NULL)
+        link = (parent->heap_left == th) ? &parent->heap_left : &parent->heap_right;
+    *link = heap_merge(th->heap_left, th->heap_right);
+    if (*link != NULL)
+        (*link)->heap_parent = parent;
+}
+
+/**
+ * @brief heap_pop removes the root of a heap, or the next one if the root is skip
+ * @return the thread, NULL if there is none
+ */
+static thread *heap_pop(thread **root, thread *skip)
+{
+    if (*root == NULL)
+        return NULL;
+    if (*root != skip)
+        return heap_take(root);
+
+    /* The next one, skip stays first */
+    thread *th = heap_take(root);
+    thread *next = (*root != NULL) ? heap_take(root) : NULL;
+    heap_push(root, th, 1);
+    return next;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                Common parts                                      ######
+ * ##############################################################################################
+ */
+
+/**
+ * @brief tick_timeslice preempts the thread at the end of its timeslice. Half a tick of margin so
+ * that a tick jittering around the end of the timeslice does not preempt the thread randomly early
+ */
+static int tick_timeslice(struct runqueue *rq, thread *current, uint64_t now)
+{
+    return now >= current->timeslice_end + TICK / 2;
+}
+
+static void wake_nothing(struct runqueue *rq, thread *th)
+{
+}
+
+static int wake_never_preempts(thread *th, thread *current, uint64_t now)
+{
+    return 0;
+}
+
+static void switch_nothing(thread *th, uint64_t now)
+{
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                 FIFO policy                                      ######
+ * ##############################################################################################
+ */
+
+static void fifo_enqueue(struct runqueue *rq, thread *th, int head)
+{
+    if (head)
+        TAILQ_INSERT_HEAD(&rq->fifo, th, runq_entries);
+    else
+        TAILQ_INSERT_TAIL(&rq->fifo, th, runq_entries);
+}
+
+static thread *fifo_dequeue_next(struct runqueue *rq, thread *skip)
+{
+    thread *th = TAILQ_FIRST(&rq->fifo);
+    if (th != NULL && th == skip)
+        th = TAILQ_NEXT(th, runq_entries);
+    if (th != NULL)
+        TAILQ_REMOVE(&rq->fifo, th, runq_entries);
+    return th;
+}
+
+static void fifo_remove(struct runqueue *rq, thread *th)
+{
+    TAILQ_REMOVE(&rq->fifo, th, runq_entries);
+}
+
+static __useconds_t fifo_timeslice(thread *th)
+{
+    return TIMESLICE;
+}
+
+static const struct sched_ops fifo_ops = {
+    .name = "fifo",
+    .enqueue = fifo_enqueue,
+    .dequeue_next = fifo_dequeue_next,
+    .remove = fifo_remove,
+    .on_wake = wake_nothing,
+    .on_tick = tick_timeslice,
+    .wake_preempts = wake_never_preempts,
+    .on_switch = switch_nothing,
+    .timeslice = fifo_timeslice,
+};
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                              Priority policy                                     ######
+ * ##############################################################################################
+ */
+
+static void priority_enqueue(struct runqueue *rq, thread *th, int head)
+{
+    int level = th->priority.value - 1;
+    th->level = level;
+
+    /* The level starts waiting now */
+    if (TAILQ_EMPTY(&rq->levels[level]))
+    {
+        rq->bitmap |= 1u << level;
+        rq->served[level] = rq->picks;
+    }
+    if (head)
+        TAILQ_INSERT_HEAD(&rq->levels[level], th, runq_entries);
+    else
+        TAILQ_INSERT_TAIL(&rq->levels[level], th, runq_entries);
+}
+
+/**
+ * @brief priority_take removes the first thread of a level which is not empty
+ * @return the thread, NULL if skip is the only thread of the level
+ */
+static thread *priority_take(struct runqueue *rq, int level, thread *skip)
+{
+    thread *th = TAILQ_FIRST(&rq->levels[level]);
+    if (th == skip)
+        th = TAILQ_NEXT(th, runq_entries);
+    if (th == NULL)
+        return NULL;
+
+    TAILQ_REMOVE(&rq->levels[level], th, runq_entries);
+    if (TAILQ_EMPTY(&rq->levels[level]))
+        rq->bitmap &= ~(1u << level);
+    rq->served[level] = rq->picks;
+    return th;
+}
+
+static thread *priority_dequeue_next(struct runqueue *rq, thread *skip)
+{
+    unsigned int bitmap = rq->bitmap;
+    if (bitmap == 0)
+        return NULL;
+    rq->picks++;
+
+    /* Highest priority waiting */
+    int level = 31 - __builtin_clz(bitmap);
+
+    /* Aging: the lower level waiting for the longest time goes first once it waited for AGING picks.
+     * At most NB_PRIORITIES - 1 levels to look at */
+    unsigned int lower = bitmap & ~(1u << level);
+    unsigned int oldest = AGING;
+    while (lower)
+    {
+        int l = __builtin_ctz(lower);
+        lower &= lower - 1;
+        if (rq->picks - rq->served[l] > oldest)
+        {
+            oldest = rq->picks - rq->served[l];
+            level = l;
+        }
+    }
+
+    thread *th = priority_take(rq, level, skip);
+    /* Only skip at this level: the highest other level */
+    for (int l = NB_PRIORITIES - 1; th == NULL && l >= 0; l--)
+    {
+        if (l != level && (bitmap & (1u << l)))
+            th = priority_take(rq, l, skip);
+    }
+    return th;
+}
+
+static void priority_remove(struct runqueue *rq, thread *th)
+{
+    /* The priority may have changed since th was queued: its level was kept */
+    int level = th->level;
+    TAILQ_REMOVE(&rq->levels[level], th, runq_entries);
+    if (TAILQ_EMPTY(&rq->levels[level]))
+        rq->bitmap &= ~(1u << level);
+}
+
+static int priority_wake_preempts(thread *th, thread *current, uint64_t now)
+{
+    return th->priority.value > current->priority.value;
+}
+
+/**
+ * @brief priority_timeslice gives a timeslice growing with the priority, from 4 ms to 22 ms
+ */
+static __useconds_t priority_timeslice(thread *th)
+{
+    if (th->priority.value%2 == 1) // priority is an odd value
+    {
+        return TIMESLICE * (th->priority.value/2 + 1);
+    }
+    else // priority is an even value so we need to alternate between higher and lower timeslices
+    {
+        if (th->priority.alternate)
+        {
+            th->priority.alternate = 0;
+            return TIMESLICE * (th->priority.value/2 + 1);
+        }
+        else
+        {
+            th->priority.alternate = 1;
+            return TIMESLICE * (th->priority.value/2);
+        }
+    }
+}
+
+static const struct sched_ops priority_ops = {
+    .name = "priority",
+    .enqueue = priority_enqueue,
+    .dequeue_next = priority_dequeue_next,
+    .remove = priority_remove,
+    .on_wake = wake_nothing,
+    .on_tick = tick_timeslice,
+    .wake_preempts = priority_wake_preempts,
+    .on_switch = switch_nothing,
+    .timeslice = priority_timeslice,
+};
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                Fair policy                                       ######
+ * ##############################################################################################
+ */
+
+static void fair_on_wake(struct runqueue *rq, thread *th)
+{
+    /* At most one timeslice of credit for a thread which slept */
+    if (rq->min_vruntime > TIMESLICE && th->vruntime < rq->min_vruntime - TIMESLICE)
+        th->vruntime = rq->min_vruntime - TIMESLICE;
+}
+
+static void fair_enqueue(struct runqueue *rq, thread *th, int head)
+{
+    if (head && rq->fair_root != NULL && rq->fair_root->vruntime < th->vruntime)
+        th->vruntime = rq->fair_root->vruntime;
+
+    th->heap_key = th->vruntime;
+    heap_push(&rq->fair_root, th, head);
+}
+
+static thread *fair_dequeue_next(struct runqueue *rq, thread *skip)
+{
+    thread *th = heap_pop(&rq->fair_root, skip);
+    if (th != NULL && th->vruntime > rq->min_vruntime)
+        rq->min_vruntime = th->vruntime;
+    return th;
+}
+
+static void fair_remove(struct runqueue *rq, thread *th)
+{
+    heap_remove(&rq->fair_root, th);
+}
+
+static void fair_on_switch(thread *th, uint64_t now)
+{
+    th->vruntime += (now - th->run_start) * FAIR_WEIGHT / th->priority.value;
+}
+
+static int fair_wake_preempts(thread *th, thread *current, uint64_t now)
+{
+    /* current is charged when it is left: count the time it has run since it was resumed */
+    uint64_t vruntime = current->vruntime + (now - current->run_start) * FAIR_WEIGHT / current->priority.value;
+    return th->vruntime + WAKEUP_GRANULARITY < vruntime;
+}
+
+static const struct sched_ops fair_ops = {
+    .name = "fair",
+    .enqueue = fair_enqueue,
+    .dequeue_next = fair_dequeue_next,
+    .remove = fair_remove,
+    .on_wake = fair_on_wake,
+    .on_tick = tick_timeslice,
+    .wake_preempts = fair_wake_preempts,
+    .on_switch = fair_on_switch,
+    .timeslice = priority_timeslice,
+};
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/* Chosen before the first thread is created, read-only afterwards */
+const struct sched_ops *g_sched_ops = &priority_ops;
+int g_wakeup_preempt = 0;
+
+void runqueue_policy_init()
+{
+    static const struct sched_ops *policies[] = {&fifo_ops, &priority_ops, &fair_ops};
+    const char *env = getenv("THREAD_SCHED");
+    for (int i = 0; env != NULL && i < sizeof(policies) / sizeof(policies[0]); i++)
+    {
+        if (strcmp(env, policies[i]->name) == 0)
+            g_sched_ops = policies[i];
+    }
+
+    env = getenv("THREAD_WAKEUP_PREEMPT");
+    g_wakeup_preempt = (env != NULL && atoi(env) != 0);
+}
+
+/*
+ * ##############################################################################################
+ * ######                                 Run queues                                       ######
+ * ##############################################################################################
+ */
+
+void runqueue_init(struct runqueue *rq)
+{
+    rq->nb_ready = 0;
+    TAILQ_INIT(&rq->fifo);
+    for (int i = 0; i < NB_PRIORITIES; i++)
+    {
+        TAILQ_INIT(&rq->levels[i]);
+        rq->served[i] = 0;
+    }
+    rq->bitmap = 0;
+    rq->picks = 0;
+    rq->fair_root = NULL;
+    rq->min_vruntime = 0;
+    rq->edf_root = NULL;
+    rq->sleep_root = NULL;
+}
+
+void runqueue_push(struct runqueue *rq, thread *th, int flags)
+{
+    int head = flags & RUNQ_HEAD;
+    th->runq = rq;
+
+    /* Periodic threads, before the policy */
+    if (th->period != 0)
+    {
+        uint64_t now = get_time();
+        if (th->release > now)
+        {
+            th->heap_key = th->release;
+            heap_push(&rq->sleep_root, th, 0);
+        }
+        else
+        {
+            th->heap_key = runqueue_deadline(th, now);
+            heap_push(&rq->edf_root, th, head);
+        }
+        return;
+    }
+
+    if (flags & RUNQ_WAKE)
+        g_sched_ops->on_wake(rq, th);
+    g_sched_ops->enqueue(rq, th, head);
+    rq->nb_ready++;
+}
+
+thread *runqueue_pop(struct runqueue *rq, thread *skip)
+{
+    /* The periodic threads released since the last call are ready */
+    if (rq->sleep_root != NULL)
+    {
+        uint64_t now = get_time();
+        while (rq->sleep_root != NULL && rq->sleep_root->release <= now)
+        {
+            thread *th = heap_take(&rq->sleep_root);
+            th->heap_key = runqueue_deadline(th, now);
+            heap_push(&rq->edf_root, th, 0);
+        }
+    }
+
+    thread *th = heap_pop(&rq->edf_root, skip);
+    if (th == NULL && rq->nb_ready > 0)
+    {
+        th = g_sched_ops->dequeue_next(rq, skip);
+        if (th != NULL)
+            rq->nb_ready--;
+    }
+    if (th != NULL)
+        th->runq = NULL;
+    return th;
+}
+
+int runqueue_remove(struct runqueue *rq, thread *th)
+{
+    if (th->runq != rq)
+        return EXIT_FAILURE;
+
+    if (th->period != 0)
+    {
+        /* Not released yet: it cannot run */
+        if (th->release > get_time())
+            return EXIT_FAILURE;
+        /* Released but maybe not moved to the released threads yet: the root tells the heap */
+        thread *top = th;
+        while (top->heap_parent != NULL)
+            top = top->heap_parent;
+        heap_remove((top == rq->edf_root) ? &rq->edf_root : &rq->sleep_root, th);
+    }
+    else
+    {
+        g_sched_ops->remove(rq, th);
+        rq->nb_ready--;
+    }
+    th->runq = NULL;
+    return EXIT_SUCCESS;
+}
+
+int runqueue_empty(struct runqueue *rq)
+{
+    return __atomic_load_n(&rq->nb_ready, __ATOMIC_RELAXED) == 0
+        && __atomic_load_n(&rq->edf_root, __ATOMIC_RELAXED) == NULL
+        && __atomic_load_n(&rq->sleep_root, __ATOMIC_RELAXED) == NULL;
+}
+
+/**
+ * @brief edf_preempts tells whether a periodic thread ready goes before the current thread
+ */
+static int edf_preempts(thread *th, thread *current, uint64_t now)
+{
+    return current->period == 0 || runqueue_deadline(th, now) < runqueue_deadline(current, now);
+}
+
+int runqueue_tick(struct runqueue *rq, thread *current, uint64_t now)
+{
+    /* A periodic thread ready, woken up or released, with an earlier deadline preempts current anyway */
+    thread *th = __atomic_load_n(&rq->edf_root, __ATOMIC_RELAXED);
+    if (th != NULL && edf_preempts(th, current, now))
+        return 1;
+    th = __atomic_load_n(&rq->sleep_root, __ATOMIC_RELAXED);
+    if (th != NULL && th->release <= now && edf_preempts(th, current, now))
+        return 1;
+    return g_sched_ops->on_tick(rq, current, now);
+}
+
+int runqueue_wake_preempts(thread *th, thread *current)
+{
+    if (!g_wakeup_preempt)
+        return 0;
+
+    uint64_t now = get_time();
+    /* The periodic threads go first, by deadline */
+    if (th->period != 0 || current->period != 0)
+        return th->period != 0 && (current->period == 0 || runqueue_deadline(th, now) < runqueue_deadline(current, now));
+    return g_sched_ops->wake_preempts(th, current, now);
+}
+
+void runqueue_account(thread *th, uint64_t now)
+{
+    g_sched_ops->on_switch(th, now);
+}
+
+__useconds_t runqueue_timeslice(thread *th)
+{
+    return g_sched_ops->timeslice(th);
+}
+
+uint64_t runqueue_deadline(thread *th, uint64_t now)
+{
+    /* A late job goes after the jobs which can still be done in time */
+    return (th->deadline > now) ? th->deadline : now + th->rel_deadline;
+}
+
+uint64_t runqueue_next_release(struct runqueue *rq)
+{
+    return (rq->sleep_root != NULL) ? rq->sleep_root->release : 0;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_PTHREAD */
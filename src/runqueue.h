@@ -0,0 +1,162 @@
+/**
+  * \file runqueue.h
+  * \brief run queues and scheduling policies
+  *
+  * The order of the threads is given by a scheduling policy (struct sched_ops), chosen once with
+  * the environment variable THREAD_SCHED before the first thread is created:
+  *
+  * fifo: one FIFO, every thread has the same timeslice (round-robin).
+  *
+  * priority (default): one FIFO for each priority. The threads of the highest priority are
+  * picked first, in FIFO order. A bitmap of the non-empty FIFOs gives the highest one in O(1).
+  * To prevent starvation, a lower priority that has not been served for AGING picks is served
+  * before the highest one. The priority of a thread is read when it is put in the run queue: a new
+  * priority is taken into account the next time the thread is queued.
+  *
+  * fair: the thread which ran the least is picked first. Each thread accumulates its running time
+  * weighted by its priority (its virtual runtime), the threads are kept in a skew heap by virtual
+  * runtime. A thread woken up is put back with at most one TIMESLICE of credit behind the last
+  * thread picked, so that it is not penalized for sleeping but cannot take the processor for
+  * longer than that.
+  *
+  * With THREAD_WAKEUP_PREEMPT=1 in the environment, a thread woken up runs right away if the policy
+  * puts it before the thread waking it up (sched_ops.wake_preempts): a higher priority, or a virtual
+  * runtime behind by more than WAKEUP_GRANULARITY. The fifo policy never preempts.
+  *
+  * The periodic threads (EDF) go before the policy, whichever it is: the released thread of the
+  * earliest deadline is picked first. A periodic thread waiting for its next period is kept in
+  * another heap by release date, it is moved to the heap of the released threads by the first
+  * runqueue_pop after its release. A job still running after its deadline is scheduled as if it
+  * was released now, so that it does not make the jobs which can still be done in time late too.
+  */
+#ifndef RUNQUEUE_H
+#define RUNQUEUE_H
+
+#include "define.h"
+
+// Flags of runqueue_push
+#define RUNQ_HEAD 1 /*! before the threads of the same rank instead of after them */
+#define RUNQ_WAKE 2 /*! the thread was blocked or is new, see sched_ops.on_wake */
+
+/**
+ * \struct sched_ops a scheduling policy
+ * All of them are called with the run queue locked (USE_MN), except on_tick
+ */
+struct sched_ops
+{
+    const char *name; /*!< value of THREAD_SCHED choosing the policy */
+    void (*enqueue)(struct runqueue *rq, thread *th, int head); /*!< puts th in the run queue */
+    thread *(*dequeue_next)(struct runqueue *rq, thread *skip); /*!< removes the next thread, see runqueue_pop */
+    void (*remove)(struct runqueue *rq, thread *th); /*!< removes th, which is in the run queue */
+    void (*on_wake)(struct runqueue *rq, thread *th); /*!< prepares a thread woken up or new before enqueue */
+    int (*on_tick)(struct runqueue *rq, thread *current, uint64_t now); /*!< tells whether the tick preempts current */
+    int (*wake_preempts)(thread *th, thread *current, uint64_t now); /*!< tells whether th, just woken up, goes before current */
+    void (*on_switch)(thread *th, uint64_t now); /*!< charges the time th has run since th->run_start */
+    __useconds_t (*timeslice)(thread *th); /*!< the timeslice given to th when it is resumed */
+};
+
+/**
+ * \var g_sched_ops the scheduling policy of all the run queues
+ */
+extern const struct sched_ops *g_sched_ops;
+
+/**
+ * \var g_wakeup_preempt 1 if the threads woken up may preempt the current thread (THREAD_WAKEUP_PREEMPT)
+ */
+extern int g_wakeup_preempt;
+
+/**
+ * @brief runqueue_policy_init chooses the scheduling policy named by the environment variable
+ * THREAD_SCHED (fifo, priority or fair), priority if it is not set or unknown, and the wake-up
+ * preemption with THREAD_WAKEUP_PREEMPT
+ * Called once, before any thread is queued
+ */
+void runqueue_policy_init();
+
+/**
+ * @brief runqueue_init initializes an empty run queue
+ * @param rq the run queue
+ */
+void runqueue_init(struct runqueue *rq);
+
+/**
+ * @brief runqueue_push puts th in the run queue
+ * @param rq the run queue
+ * @param th a thread which is not running
+ * @param flags RUNQ_* flags
+ */
+void runqueue_push(struct runqueue *rq, thread *th, int flags);
+
+/**
+ * @brief runqueue_pop removes the next thread to run
+ * @param rq the run queue
+ * @param skip a thread that must not be taken if it is the next one of its queue, or NULL
+ * @return the thread, NULL if there is nothing to run
+ */
+thread *runqueue_pop(struct runqueue *rq, thread *skip);
+
+/**
+ * @brief runqueue_remove removes a given thread from the run queue, to run it right away
+ * @param rq the run queue
+ * @param th the thread
+ * @return EXIT_SUCCESS, EXIT_FAILURE if th is not in rq or is a periodic thread not released yet
+ */
+int runqueue_remove(struct runqueue *rq, thread *th);
+
+/**
+ * @brief runqueue_empty tells whether there is a thread in the run queue
+ * It can be called without the lock protecting the run queue, as a hint
+ * @param rq the run queue
+ * @return 1 if the run queue is empty, 0 otherwise
+ */
+int runqueue_empty(struct runqueue *rq);
+
+/**
+ * @brief runqueue_tick tells whether the current thread must be preempted, on each tick
+ * It can be called without the lock protecting the run queue, as a hint
+ * @param rq the run queue of the current thread
+ * @param current the thread running
+ * @param now the current date in microseconds
+ * @return 1 if a periodic thread ready or released has an earlier deadline, or if the policy preempts current
+ */
+int runqueue_tick(struct runqueue *rq, thread *current, uint64_t now);
+
+/**
+ * @brief runqueue_wake_preempts tells whether a thread woken up must run before the current thread
+ * @param th the thread woken up, already in the run queue
+ * @param current the thread running
+ * @return 1 if the wake-up preemption is enabled and th goes first: earlier deadline, or periodic
+ * thread woken up by a thread which is not, or the policy says so; 0 otherwise
+ */
+int runqueue_wake_preempts(thread *th, thread *current);
+
+/**
+ * @brief runqueue_account charges the time th has run since it was resumed
+ * @param th the thread left
+ * @param now the current date in microseconds
+ */
+void runqueue_account(thread *th, uint64_t now);
+
+/**
+ * @brief runqueue_timeslice gives the timeslice of th
+ * @param th the thread resumed
+ * @return the timeslice in microseconds
+ */
+__useconds_t runqueue_timeslice(thread *th);
+
+/**
+ * @brief runqueue_deadline gives the deadline used to schedule a periodic thread released
+ * @param th the periodic thread
+ * @param now the current date in microseconds
+ * @return the deadline of its job, or now plus its relative deadline if the job is late
+ */
+uint64_t runqueue_deadline(thread *th, uint64_t now);
+
+/**
+ * @brief runqueue_next_release gives the date of the next release of a periodic thread
+ * @param rq the run queue
+ * @return the date in microseconds, 0 if no periodic thread waits for its next period
+ */
+uint64_t runqueue_next_release(struct runqueue *rq);
+
+#endif // RUNQUEUE_H
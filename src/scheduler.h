@@ -0,0 +1,127 @@
+/**
+  * \file scheduler.h
+  * \brief internal functions of the scheduler shared by thread.c and mutex.c
+  *
+  * All of them must be called with the interruptions disabled.
+  *
+  * A switch is always completed by the resumed thread: the thread left is only put back in a run
+  * queue (or its stack given back) once the resumed thread runs on its own stack. With USE_MN,
+  * another worker could otherwise resume the thread left before its registers are saved.
+  */
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "define.h"
+#ifdef USE_WORKERS
+#include "worker.h"
+#endif
+
+// Actions done on g_prev_thread by finish_switch
+#define SWITCH_REQUEUE 1 /*! put the thread left at the tail of the run queue */
+#define SWITCH_UNLOCK 2 /*! release g_lock, taken by the thread left before switching */
+#define SWITCH_FREE 4 /*! the thread left has exited: give back its stack (USE_MN), and its structure if detached */
+#define SWITCH_EXIT 8 /*! the context of the thread left is not saved */
+#define SWITCH_DONATE 16 /*! the next thread runs for the rest of the timeslice of the thread left */
+
+/* g_lock protects the data shared by the workers: the table of handles, the pools, the status and
+ * joinq of the threads and the sleep queues of the mutexes. Only needed with USE_MN */
+#ifdef USE_MN
+#define LOCK() spin_lock(&g_lock)
+#define UNLOCK() spin_unlock(&g_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+/**
+ * @brief disable_interruptions starts a critical section of the scheduler
+ */
+void disable_interruptions();
+
+/**
+ * @brief enable_interruptions ends a critical section, a delayed preemption is done then
+ */
+void enable_interruptions();
+
+/**
+ * @brief get_time returns the monotonic clock in microseconds
+ */
+uint64_t get_time();
+
+/**
+ * @brief runq_push puts th back in the run queue after it ran, behind the threads of its rank in
+ * the scheduling policy, see runqueue.h
+ * @param th a thread which is not running
+ */
+void runq_push(thread *th);
+
+/**
+ * @brief runq_push_head puts th back in the run queue before the threads of its rank, it will be
+ * the next one of its rank to run
+ * @param th a thread which is not running
+ */
+void runq_push_head(thread *th);
+
+/**
+ * @brief runq_wake puts a thread which was blocked, or a new thread, in the run queue
+ * @param th a thread which is not running
+ */
+void runq_wake(thread *th);
+
+/**
+ * @brief runq_wake_head same as runq_wake, before the threads of its rank
+ * @param th a thread which is not running
+ */
+void runq_wake_head(thread *th);
+
+/**
+ * @brief runq_remove takes th out of the run queue to run it right away
+ * @param th a thread
+ * @return EXIT_SUCCESS, EXIT_FAILURE if th is not in the run queue of the calling thread
+ * (USE_MN: of any worker, the first one only for main)
+ */
+int runq_remove(thread *th);
+
+/**
+ * @brief runq_pop removes the next thread to run from the run queue, in the order of the policy
+ * @return the thread, NULL if there is nothing to run
+ */
+thread *runq_pop();
+
+/**
+ * @brief switch_to leaves the current thread and resumes next
+ * @param next the thread to resume, not in a run queue
+ * @param actions SWITCH_* flags, what to do with the current thread once it is left
+ */
+void switch_to(thread *next, int actions);
+
+/**
+ * @brief finish_switch does the actions asked by the last switch on the thread left
+ * Called by the resumed thread right after the switch
+ */
+void finish_switch();
+
+/**
+ * @brief block leaves the current thread for the next thread to run
+ * The caller has put the current thread in a sleep queue, where it will be woken up from
+ * @param actions SWITCH_* flags, what to do with the current thread once it is left
+ */
+void block(int actions);
+
+#ifndef USE_MN
+/**
+ * @brief runq_pop_wait removes the next thread to run, waiting for the release of a periodic thread
+ * if nothing else can run. With USE_MN, the idle thread of the worker waits instead
+ * @return the thread, NULL if there is nothing to run and nothing to wait for
+ */
+thread *runq_pop_wait();
+#endif
+
+#ifdef USE_SHARDS
+/**
+ * @brief receive_threads creates the threads sent to the current shard by the others
+ */
+void receive_threads();
+#endif
+
+#endif // SCHEDULER_H
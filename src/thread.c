@@ -1,8 +1,43 @@
 #include "thread.h"
 
 #ifndef USE_PTHREAD
-#include "retval.h"
 #include "define.h"
+#include "context.h"
+#include "pool.h"
+#include "scheduler.h"
+#include "runqueue.h"
+#include "park.h"
+#include "handle.h"
+
+/*
+ * ##############################################################################################
+ * ######                                Static data                                       ######
+ * ##############################################################################################
+ */
+
+#ifndef USE_MN
+SHARD_LOCAL thread *g_prev_thread;
+SHARD_LOCAL int g_switch_actions = 0;
+SHARD_LOCAL struct runqueue g_runq;
+#else
+int g_main_waiting = 0;
+#endif
+SCHED_LOCAL thread *g_current_thread;
+SCHED_LOCAL volatile sig_atomic_t g_in_scheduler = 0;
+SCHED_LOCAL volatile sig_atomic_t g_preemption_pending = 0;
+#ifdef USE_WORKERS
+/* Threads not exited yet on all the workers (and threads sent to a shard), main excluded.
+ * Main waits for them before ending the process */
+int g_nb_alive = 0;
+#endif
+SHARD_LOCAL thread *g_main_thread;
+SHARD_LOCAL struct thread_list_free g_to_free;
+sigset_t set;
+SHARD_LOCAL stack_t segv_stack;
+
+/*
+ * ______________________________________________________________________________________________
+ */
 
 /*
  * ##############################################################################################
@@ -11,13 +46,30 @@
  */
 void free_context(thread *th)
 {
-    STAILQ_REMOVE(&g_to_free, th, thread, to_free_entries);
-    /* Free the resources */
-    VALGRIND_STACK_DEREGISTER(th->valgrind_stackid);
-    CHECK(mprotect(th->ctx->uc_stack.ss_sp, 2 * PAGE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC), -1, "init_context: mprotect")
-    free(th->ctx->uc_stack.ss_sp);
-    free(th->ctx);
+    STAILQ_REMOVE(&g_to_free, th, thread, wait_entries);
+    /* Give back the stack */
+    pool_put_stack(th);
     th->status = ALREADY_FREE;
+
+    /* Nobody will join a detached thread: give back its structure too */
+    if (th->detached == THREAD_CREATE_DETACHED)
+    {
+        pool_put_thread(th);
+    }
+}
+
+/**
+ * @brief reclaim frees the stacks of the threads exited first which could not be kept in the pool
+ * It is done by the exiting threads and while there is nothing to run, never by thread_yield
+ * @param budget the maximum number of threads free'd, -1 for all of them
+ */
+void reclaim(int budget)
+{
+    thread *th;
+    while (budget-- != 0 && (th = STAILQ_FIRST(&g_to_free)) != NULL)
+    {
+        free_context(th);
+    }
 }
 
 void free_join(thread *th)
@@ -26,8 +78,36 @@ void free_join(thread *th)
     {
         free_context(th);
     }
-    free_retval(th->rv);
-    free(th);
+    pool_put_thread(th);
+}
+
+/**
+ * @brief free_threads frees the threads left and empties the pools, when the process ends
+ * @param main_thread the running thread, its structure is free'd last and its stack is not
+ */
+void free_threads(thread *main_thread)
+{
+    thread *th, *th2;
+
+    /* Free the context of the threads exited remaing */
+    th = STAILQ_FIRST(&g_to_free);
+    while (th != NULL)
+    {
+        th2 = STAILQ_NEXT(th, wait_entries);
+        if (th != main_thread)
+        {
+            free_context(th);
+        }
+        th = th2;
+    }
+    STAILQ_INIT(&g_to_free);
+
+    /* Free the remaining things: the threads not joined */
+    handle_for_each(free_join, main_thread);
+
+    pool_put_thread(main_thread);
+    pool_clear();
+    handle_clear();
 }
 
 /*
@@ -47,39 +127,110 @@ int thread_set_priority(thread_t thread, unsigned short priority)
     {
         return EXIT_FAILURE;
     }
-    else
+
+    disable_interruptions();
+    LOCK();
+    struct thread *th = handle_get(thread);
+    if (th != NULL)
     {
-        struct thread *th = (struct thread *) thread;
-        th->priority.value = priority;
-        return EXIT_SUCCESS;
+        th->base_priority = priority;
+        /* Raised by a mutex with priority inheritance: not lowered before it is released */
+        if (th->nb_inherit == 0 || priority > th->priority.value)
+            th->priority.value = priority;
     }
+    UNLOCK();
+    enable_interruptions();
+    return (th != NULL) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 unsigned short thread_get_priority(thread_t thread)
 {
-    struct thread *th = (struct thread *) thread;
-    return th->priority.value;
+    disable_interruptions();
+    LOCK();
+    struct thread *th = handle_get(thread);
+    unsigned short priority = (th != NULL) ? th->priority.value : 0;
+    UNLOCK();
+    enable_interruptions();
+    return priority;
 }
 
-__useconds_t get_priority_timeslice(thread *th)
+int thread_get_name(thread_t thread, char *buf, size_t len)
 {
-    if (th->priority.value%2 == 1) // priority is an odd value
+    if (len == 0)
+        return EINVAL;
+    disable_interruptions();
+    LOCK();
+    /* Copied in the critical section: the structure is recycled once the thread is joined */
+    struct thread *th = handle_get(thread);
+    if (th != NULL)
     {
-        return TIMESLICE * (th->priority.value/2 + 1);
+        strncpy(buf, th->name, len - 1);
+        buf[len - 1] = '\0';
     }
-    else // priority is an even value so we need to alternate between higher and lower timeslices
+    UNLOCK();
+    enable_interruptions();
+    return (th != NULL) ? EXIT_SUCCESS : ESRCH;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                              Periodic threads                                    ######
+ * ##############################################################################################
+ */
+
+int thread_wait_period(void)
+{
+    thread *me = g_current_thread;
+    if (me->period == 0)
+        return EINVAL;
+
+    disable_interruptions();
+    uint64_t now = get_time();
+    /* The job is done late */
+    if (now > me->deadline)
+        me->misses++;
+
+    /* Next period, the jobs which cannot be done in time anymore are skipped */
+    me->release += me->period;
+    while (me->release + me->rel_deadline <= now)
     {
-        if (th->priority.alternate)
-        {
-            th->priority.alternate = 0;
-            return TIMESLICE * (th->priority.value/2 + 1);
-        }
-        else
-        {
-            th->priority.alternate = 1;
-            return TIMESLICE * (th->priority.value/2);
-        }
+        me->release += me->period;
+        me->misses++;
     }
+    me->deadline = me->release + me->rel_deadline;
+
+    /* Released later: waiting in the run queue */
+    if (me->release > now)
+    {
+#ifdef USE_MN
+        block(SWITCH_REQUEUE);
+#else
+        runq_push(me);
+        block(0);
+#endif
+        enable_interruptions();
+        return EXIT_SUCCESS;
+    }
+    enable_interruptions();
+
+    /* Already released: an earlier deadline may be waiting */
+    thread_yield();
+    return EXIT_SUCCESS;
+}
+
+unsigned int thread_get_deadline_misses(thread_t thread)
+{
+    disable_interruptions();
+    LOCK();
+    struct thread *th = handle_get(thread);
+    unsigned int misses = (th != NULL) ? th->misses : 0;
+    UNLOCK();
+    enable_interruptions();
+    return misses;
 }
 
 /*
@@ -92,14 +243,55 @@ __useconds_t get_priority_timeslice(thread *th)
  * ##############################################################################################
  */
 
-void reset_timer()
+/**
+ * @brief get_time returns the monotonic clock in microseconds
+ * clock_gettime is served by the vDSO, so it does not make a syscall
+ */
+uint64_t get_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief start_timeslice gives a full timeslice to the current thread
+ * The timer keeps ticking every TICK, the thread is preempted by the first tick after timeslice_end
+ * @param prev the thread left, charged for the time it has run, or NULL
+ */
+void start_timeslice(thread *prev)
 {
-    struct itimerval newtimer;
-    CHECK(getitimer(ITIMER_PROF, &newtimer), -1, "reset_timer: getitimer")
-    newtimer.it_value.tv_usec = get_priority_timeslice(g_current_thread);
-    CHECK(setitimer(ITIMER_PROF, &newtimer, NULL), -1, "reset_timer: getitimer")
+    uint64_t now = get_time();
+    if (prev != NULL)
+        runqueue_account(prev, now);
+    g_current_thread->run_start = now;
+    g_current_thread->timeslice_end = now + runqueue_timeslice(g_current_thread);
+    /* The new thread starts a full timeslice */
+    g_preemption_pending = 0;
 }
 
+#ifdef USE_SOFT_INTERRUPTIONS
+
+void enable_interruptions()
+{
+    BARRIER();
+    g_in_scheduler = 0;
+    /* Preemption requested during the critical section */
+    if (g_preemption_pending)
+    {
+        g_preemption_pending = 0;
+        thread_yield();
+    }
+}
+
+void disable_interruptions()
+{
+    g_in_scheduler = 1;
+    BARRIER();
+}
+
+#else
+
 void enable_interruptions()
 {
     CHECK(sigprocmask(SIG_UNBLOCK, &set, NULL), -1, "enable_interruptions: sigprocmask")
@@ -110,11 +302,29 @@ void disable_interruptions()
     CHECK(sigprocmask(SIG_BLOCK, &set, NULL), -1, "disable_interruptions: sigprocmask")
 }
 
+#endif
+
 void alarm_handler(int signal)
 {
-    disable_interruptions();
-    if (!STAILQ_EMPTY(&g_runq)) {thread_yield();}
-    enable_interruptions();
+#ifdef USE_MN
+    struct runqueue *rq = &get_worker()->runq;
+#else
+    struct runqueue *rq = &g_runq;
+#endif
+    uint64_t now = get_time();
+    uint64_t deadline = park_next_deadline();
+    /* The policy keeps the current thread running, unless a timed park has passed its date */
+    if (!runqueue_tick(rq, g_current_thread, now) && (deadline == 0 || deadline > now))
+        return;
+#ifdef USE_SOFT_INTERRUPTIONS
+    /* The scheduler is being modified: delay the preemption */
+    if (g_in_scheduler)
+    {
+        g_preemption_pending = 1;
+        return;
+    }
+#endif
+    thread_yield();
 }
 
 /*
@@ -123,19 +333,377 @@ void alarm_handler(int signal)
 
 /*
  * ##############################################################################################
- * ######                           Stack overflow utilitary                               ######
+ * ######                                 Scheduling                                       ######
  * ##############################################################################################
  */
 
-void stack_overflow()
+#ifdef USE_MN
+
+void runq_push(thread *th)
+{
+    worker_push(th, 0);
+}
+
+void runq_push_head(thread *th)
+{
+    worker_push(th, RUNQ_HEAD);
+}
+
+void runq_wake(thread *th)
+{
+    worker_push(th, RUNQ_WAKE);
+}
+
+void runq_wake_head(thread *th)
+{
+    worker_push(th, RUNQ_WAKE | RUNQ_HEAD);
+}
+
+int runq_remove(thread *th)
+{
+    return worker_remove(th);
+}
+
+thread *runq_pop()
+{
+    return worker_pop();
+}
+
+#else
+
+void runq_push(thread *th)
+{
+    runqueue_push(&g_runq, th, 0);
+}
+
+void runq_push_head(thread *th)
+{
+    runqueue_push(&g_runq, th, RUNQ_HEAD);
+}
+
+void runq_wake(thread *th)
 {
-    thread *th = (thread *) thread_self();
-    CHECK(mprotect(th->ctx->uc_stack.ss_sp, 2 * PAGE_SIZE, PROT_NONE), -1, "init_context: mprotect")
+    runqueue_push(&g_runq, th, RUNQ_WAKE);
 }
 
+void runq_wake_head(thread *th)
+{
+    runqueue_push(&g_runq, th, RUNQ_WAKE | RUNQ_HEAD);
+}
+
+int runq_remove(thread *th)
+{
+    /* Under shards, the run queue of another shard is never g_runq */
+    return runqueue_remove(&g_runq, th);
+}
+
+thread *runq_pop()
+{
+#ifdef USE_SHARDS
+    /* The threads sent by the other shards join the run queue */
+    receive_threads();
+#endif
+    return runqueue_pop(&g_runq, NULL);
+}
+
+#endif
+
+void finish_switch()
+{
+    thread *prev = g_prev_thread;
+    int actions = g_switch_actions;
+    g_switch_actions = 0;
+
+    if (actions & SWITCH_REQUEUE)
+    {
+        runq_push(prev);
+    }
+    /* The exited thread is not on its stack anymore (g_lock is still held with USE_MN), and its
+     * timeslice has been charged: the structure can be recycled */
+    if (actions & SWITCH_FREE)
+    {
+#ifdef USE_MN
+        pool_put_stack(prev);
+#endif
+        prev->status = ALREADY_FREE;
+        if (prev->detached == THREAD_CREATE_DETACHED)
+            pool_put_thread(prev);
+    }
+    if (actions & SWITCH_UNLOCK)
+    {
+        UNLOCK();
+    }
+}
+
+void switch_to(thread *next, int actions)
+{
+    thread *me = g_current_thread;
+    g_prev_thread = me;
+    g_switch_actions = actions;
+    g_current_thread = next;
+
+    /* Start the timeslice of the new thread */
+    start_timeslice(me);
+    if (actions & SWITCH_DONATE)
+        next->timeslice_end = me->timeslice_end;
+    if (actions & SWITCH_EXIT)
+        context_set(next);
+    context_swap(me, next);
+
+    /* Resumed, maybe by another worker */
+    finish_switch();
+}
+
+/**
+ * @brief wake_expired wakes up the threads whose timed park has passed its date, in a critical section
+ * g_lock is only taken if there is one
+ */
+static void wake_expired()
+{
+    uint64_t deadline = park_next_deadline();
+    if (deadline != 0 && deadline <= get_time())
+    {
+        LOCK();
+        park_expire(get_time());
+        UNLOCK();
+    }
+}
+
+#ifndef USE_MN
+
+thread *runq_pop_wait()
+{
+    thread *th;
+    uint64_t release, deadline, now;
+    while ((th = runq_pop()) == NULL)
+    {
+        /* Nothing to run until a periodic thread is released or a timed park gives up */
+        release = runqueue_next_release(&g_runq);
+        deadline = park_next_deadline();
+        if (deadline != 0 && (release == 0 || deadline < release)) release = deadline;
+        if (release == 0)
+            break;
+        now = get_time();
+#ifdef USE_SHARDS
+        /* The messages of the other shards are still polled */
+        if (release > now + IDLE_SLEEP) release = now + IDLE_SLEEP;
+#endif
+        /* Idle: a good time to free the threads exited */
+        reclaim(-1);
+        if (release > now) usleep(release - now);
+        wake_expired();
+    }
+    return th;
+}
+
+#endif
+
+void block(int actions)
+{
+#ifdef USE_MN
+    thread *next = runq_pop();
+    /* Nothing to run on this worker */
+    if (next == NULL) next = get_worker()->idle;
+#else
+    thread *next = runq_pop_wait();
+#endif
+    switch_to(next, actions);
+}
+
+#ifdef USE_WORKERS
+
+/**
+ * @brief idle_wait lets the other kernel threads run while the worker has nothing to do
+ * @param nb_fails the number of calls since the worker last found something to run
+ */
+void idle_wait(int *nb_fails)
+{
+    if ((*nb_fails)++ < IDLE_SPINS)
+        sched_yield();
+    else
+        usleep(IDLE_SLEEP);
+}
+
+#endif
+
+#ifdef USE_MN
+
+/**
+ * @brief idle_loop runs on each worker while there is nothing else to run
+ * It looks for a thread in the run queue of the worker, then in the run queues of the others
+ */
+void *idle_loop(void *arg)
+{
+    int nb_fails = 0;
+    disable_interruptions();
+    while (!g_workers_stop)
+    {
+        thread *next = runq_pop();
+        if (next != NULL)
+        {
+            switch_to(next, 0);
+            nb_fails = 0;
+        }
+        else
+        {
+            idle_wait(&nb_fails);
+            wake_expired();
+        }
+    }
+    return NULL;
+}
+
+void idle_start(void *(*func)(void *), void *funcarg)
+{
+    finish_switch();
+    func(funcarg);
+}
+
+/**
+ * @brief idle_main is the function of the kernel threads of the workers
+ * Their idle thread runs on the stack of the kernel thread, it has no stack of its own
+ */
+void *idle_main(void *arg)
+{
+    LOCK();
+    thread *idle = pool_get_thread();
+    UNLOCK();
+    idle->stack = NULL;
+    idle->status = RUNNING;
+    idle->priority.value = 5;
+    idle->priority.alternate = 0;
+    idle->base_priority = idle->priority.value;
+    idle->nb_inherit = 0;
+    idle->nb_read_held = 0;
+    idle->blocked_on = NULL;
+    idle->period = 0;
+    idle->runq = NULL;
+    idle->detached = THREAD_CREATE_DETACHED;
+    strncpy(idle->name, "idle", THREAD_NAME_SIZE);
+    get_worker()->idle = idle;
+    g_current_thread = idle;
+    worker_start_timer();
+
+    idle_loop(NULL);
+
+    LOCK();
+    pool_put_thread(idle);
+    UNLOCK();
+    return NULL;
+}
+
+/**
+ * @brief wait_threads blocks main until all the other threads have exited, g_lock is held
+ */
+void wait_threads()
+{
+    while (g_nb_alive > 0)
+    {
+        g_main_waiting = 1;
+        block(SWITCH_UNLOCK);
+        LOCK();
+    }
+}
+
+#endif
+
+#ifdef USE_SHARDS
+
+/**
+ * @brief shard_main is the function of the kernel threads of the other shards
+ * As main on the first shard, its thread runs on the stack of the kernel thread and is the
+ * g_main_thread of the shard. It runs the threads of the shard and polls the messages while idle
+ */
+void *shard_main(void *arg)
+{
+    pool_init();
+    thread *th = pool_get_thread();
+    th->stack = NULL;
+    th->status = RUNNING;
+    th->joinq = NULL;
+    th->priority.value = 5;
+    th->priority.alternate = 0;
+    th->base_priority = th->priority.value;
+    th->nb_inherit = 0;
+    th->nb_read_held = 0;
+    th->blocked_on = NULL;
+    th->period = 0;
+    th->runq = NULL;
+    th->detached = THREAD_CREATE_JOINABLE;
+    strncpy(th->name, "shard", THREAD_NAME_SIZE);
+    th->shard = worker_id();
+
+    /* Initialization of the queues of the shard */
+    handle_init();
+    park_init();
+    runqueue_init(&g_runq);
+    STAILQ_INIT(&g_to_free);
+    g_current_thread = th;
+    g_main_thread = th;
+    handle_alloc(th);
+    start_timeslice(NULL);
+    worker_start_timer();
+
+    int nb_fails = 0;
+    while (!g_workers_stop)
+    {
+        thread *next = runq_pop();
+        if (next != NULL)
+        {
+            switch_to(next, 0);
+            nb_fails = 0;
+        }
+        else
+        {
+            reclaim(-1);
+            idle_wait(&nb_fails);
+            wake_expired();
+        }
+    }
+
+    free_threads(th);
+    return NULL;
+}
+
+/**
+ * @brief wait_threads runs the threads of the first shard until the threads of all the shards
+ * have exited. Main runs it once it is the last thread of the first shard
+ */
+void wait_threads()
+{
+    thread *new_current;
+    int nb_fails = 0;
+    while ((new_current = runq_pop()) != NULL || __atomic_load_n(&g_nb_alive, __ATOMIC_ACQUIRE) > 0)
+    {
+        if (new_current != NULL)
+        {
+            switch_to(new_current, 0);
+            nb_fails = 0;
+        }
+        else
+        {
+            reclaim(-1);
+            idle_wait(&nb_fails);
+            wake_expired();
+        }
+    }
+}
+
+#endif
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                           Stack overflow utilitary                               ######
+ * ##############################################################################################
+ */
+
 void sigsegv_handler(int signum, siginfo_t *info, void *data)
 {
-    printf("/!\\ SEGFAULT (stack overflow) /!\\ thread %p\n", (thread *) thread_self());
+    printf("/!\\ SEGFAULT (stack overflow) /!\\ thread %p\n", thread_self());
     thread_exit(SEGFAULT);
 }
 
@@ -151,9 +719,9 @@ void sigsegv_handler(int signum, siginfo_t *info, void *data)
 
 void force_exit(void *(*func)(void *), void *funcarg)
 {
-    stack_overflow();
     if (func != NULL)
     {
+        finish_switch();
         enable_interruptions();
         void *res = func(funcarg);
         thread_exit(res);
@@ -163,13 +731,11 @@ void force_exit(void *(*func)(void *), void *funcarg)
 void finalize_join(thread *th, void **retval)
 {
     /* Collecting the value of retval */
-    if (retval) *retval = get_value(th->rv);
+    if (retval) *retval = get_value(&th->rv);
 
-    /* If not thread main free the resources */
-    if (th != STAILQ_FIRST(&g_all_threads))
+    /* If not thread main free the resources, its handle is released with its structure */
+    if (th != g_main_thread)
     {
-        // Removing the thread from the threads joignable
-        STAILQ_REMOVE(&g_all_threads, th, thread, all_entries);
         free_join(th);
     }
 }
@@ -184,59 +750,109 @@ void finalize_join(thread *th, void **retval)
  * ##############################################################################################
  */
 
-thread *init_context(void *(*func)(void *), void *funcarg)
+thread *init_context(void *(*func)(void *), void *funcarg, size_t stack_size)
 {
-    thread *th = malloc(sizeof(thread));
-    CHECK(th, NULL, "init_context: thread pointer malloc")
-    th->ctx = malloc(sizeof(ucontext_t));
-    CHECK(th->ctx, NULL, "init_context: context malloc")
-    getcontext(th->ctx);
-
-    th->ctx->uc_stack.ss_size = NB_PAGES * PAGE_SIZE;
-    th->ctx->uc_stack.ss_sp = valloc(th->ctx->uc_stack.ss_size);
-    int valgrind_stackid = VALGRIND_STACK_REGISTER(th->ctx->uc_stack.ss_sp,
-                                                   th->ctx->uc_stack.ss_sp + th->ctx->uc_stack.ss_size);
-    th->valgrind_stackid = valgrind_stackid;
+    /* Recycled thread structure and stack (guard pages already protected) */
+    LOCK();
+    thread *th = pool_get_thread();
+    pool_get_stack(th, stack_size);
+    UNLOCK();
     th->status = RUNNING;
-    th->ctx->uc_link = NULL;
 
-    makecontext(th->ctx, (void (*)(void)) force_exit, 2, func, funcarg);
+    context_make(th, force_exit, func, funcarg);
 
     return th;
 }
 
-void add_to_scheduler(thread *th)
+/**
+ * @brief add_to_scheduler registers th and puts it in the run queue
+ * @param th the thread, ready to run
+ * @param newthread receives the handle of th before it can run
+ */
+void add_to_scheduler(thread *th, thread_t *newthread)
 {
-    /* Insert the current thread in the run queue */
-    STAILQ_INSERT_TAIL(&g_runq, th, runq_entries);
-    /* Put the thread in g_all_threads so we can free it later */
-    STAILQ_INSERT_TAIL(&g_all_threads, th, all_entries);
+    /* The handle finds the thread until it is free'd, even when it is detached */
+    LOCK();
+    *newthread = handle_alloc(th);
+#ifdef USE_MN
+    g_nb_alive++;
+#elif defined(USE_SHARDS)
+    __atomic_add_fetch(&g_nb_alive, 1, __ATOMIC_RELAXED);
+#endif
+    UNLOCK();
+    /* Insert the thread in the run queue, another worker may run it right away */
+    runq_wake(th);
 }
 
-/*
- * ______________________________________________________________________________________________
+/**
+ * @brief new_thread creates a thread and puts it in the run queue, the interruptions are disabled
+ * @param newthread receives the identifier of the thread before it can run
+ * @param attr valid attributes of the thread
+ * @param func the function of the thread
+ * @param funcarg the argument of func
  */
+void new_thread(thread_t *newthread, const thread_attr_t *attr, void *(*func)(void *), void *funcarg)
+{
+    /* Round up to a whole number of pages */
+    size_t stack_size = (attr->stack_size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
 
-/*
- * ##############################################################################################
- * ######                         Errors testing functions                                 ######
- * ##############################################################################################
- */
+    /* Initialization of the context */
+    thread *th = init_context(func, funcarg, stack_size);
 
-int is_existing(thread *th)
-{
-    struct thread *th_i;
-    STAILQ_FOREACH(th_i, &g_all_threads, all_entries)
+    /* Initialization of the return value, nobody will read the one of a detached thread */
+    if (attr->detachstate == THREAD_CREATE_JOINABLE)
     {
-        if (th_i == th)
-            break;
-        if (STAILQ_NEXT(th_i, all_entries) == NULL)
-            return ESRCH;
+        th->rv.value = NULL;
     }
 
-    return EXIT_SUCCESS;
+    /* Initialize the thread's sleep queue */
+    th->joinq = NULL;
+
+    /* Attributes, set before the thread can be scheduled */
+    th->priority.value = attr->priority;
+    th->priority.alternate = 0;
+    th->base_priority = th->priority.value;
+    th->nb_inherit = 0;
+    th->nb_read_held = 0;
+    th->blocked_on = NULL;
+    th->vruntime = 0;
+    th->period = attr->period;
+    th->rel_deadline = attr->deadline ? attr->deadline : attr->period;
+    th->misses = 0;
+    th->runq = NULL;
+    /* The first job is released now */
+    th->release = get_time();
+    th->deadline = th->release + th->rel_deadline;
+    th->detached = attr->detachstate;
+    memcpy(th->name, attr->name, THREAD_NAME_SIZE);
+#ifdef USE_SHARDS
+    th->shard = worker_id();
+#endif
+
+    /* Add the thread to the scheduler, giving its handle */
+    add_to_scheduler(th, newthread);
 }
 
+#ifdef USE_SHARDS
+
+void receive_threads()
+{
+    message msg;
+    thread_attr_t attr;
+    thread_t th;
+
+    thread_attr_init(&attr);
+    thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+    while (worker_receive(&msg) == EXIT_SUCCESS)
+    {
+        new_thread(&th, &attr, msg.func, msg.funcarg);
+        /* Already counted by the sender, so that main never misses a message being sent */
+        __atomic_sub_fetch(&g_nb_alive, 1, __ATOMIC_RELAXED);
+    }
+}
+
+#endif
+
 /*
  * ______________________________________________________________________________________________
  */
@@ -249,59 +865,154 @@ int is_existing(thread *th)
 
 thread_t thread_self(void)
 {
-    return g_current_thread;
+    return g_current_thread->handle;
 }
 
-int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg)
+int thread_list(thread_t *threads, int size)
 {
     disable_interruptions();
-    /* Initialization of the context */
-    thread *th = init_context(func, funcarg);
-
-    /* Initialization of the return value */
-    th->rv = init_retval();
+    LOCK();
+    int nb = handle_list(threads, size);
+    UNLOCK();
+    enable_interruptions();
+    return nb;
+}
 
-    /* Initialize the thread's sleep queue */
-    th->joinq = NULL;
+int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg)
+{
+    return thread_create_ex(newthread, NULL, func, funcarg);
+}
 
-    /* Add the thread to the scheduler */
-    add_to_scheduler(th);
+int thread_create_stack(thread_t *newthread, void *(*func)(void *), void *funcarg, size_t stack_size)
+{
+    thread_attr_t attr;
+    thread_attr_init(&attr);
+    if (thread_attr_setstacksize(&attr, stack_size) != EXIT_SUCCESS)
+        return EINVAL;
+    return thread_create_ex(newthread, &attr, func, funcarg);
+}
 
-    /* Give a default priority of 5 */
-    th->priority.value = 5;
-    th->priority.alternate = 0;
+int thread_create_ex(thread_t *newthread, const thread_attr_t *attr, void *(*func)(void *), void *funcarg)
+{
+    thread_attr_t default_attr;
+    if (attr == NULL)
+    {
+        thread_attr_init(&default_attr);
+        attr = &default_attr;
+    }
 
-    /* Giving the return value */
-    *newthread = (thread_t) th;
+    /* The stack must at least hold the frames of the signal handlers */
+    if (attr->stack_size < STACK_MIN || attr->priority < 1 || attr->priority > 10 || attr->deadline > attr->period
+        || (attr->detachstate != THREAD_CREATE_JOINABLE && attr->detachstate != THREAD_CREATE_DETACHED))
+        return EINVAL;
 
+    disable_interruptions();
+    new_thread(newthread, attr, func, funcarg);
     enable_interruptions();
 
     return EXIT_SUCCESS;
 }
 
+int thread_shard_count(void)
+{
+#ifdef USE_SHARDS
+    return worker_count();
+#else
+    return 1;
+#endif
+}
+
+int thread_shard_self(void)
+{
+#ifdef USE_SHARDS
+    return worker_id();
+#else
+    return 0;
+#endif
+}
+
+int thread_submit_to(int shard, void *(*func)(void *), void *funcarg)
+{
+    if (shard < 0 || shard >= thread_shard_count())
+        return EINVAL;
+
+#ifdef USE_SHARDS
+    if (shard != worker_id())
+    {
+        int err;
+        /* The threads of the shard must not write in the same ring at the same time */
+        disable_interruptions();
+        /* Counted before being sent, see receive_threads */
+        __atomic_add_fetch(&g_nb_alive, 1, __ATOMIC_RELAXED);
+        err = worker_send(shard, func, funcarg);
+        if (err)
+            __atomic_sub_fetch(&g_nb_alive, 1, __ATOMIC_RELAXED);
+        enable_interruptions();
+        return err;
+    }
+#endif
+
+    /* Current shard */
+    thread_attr_t attr;
+    thread_t th;
+    thread_attr_init(&attr);
+    thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+    return thread_create_ex(&th, &attr, func, funcarg);
+}
+
 int thread_yield(void)
 {
     disable_interruptions();
+    wake_expired();
+
+    /* Update scheduler, the current thread keeps running if it is alone */
+    thread *me = g_current_thread;
+    thread *new_current = runq_pop();
 
-    /* Free the processes waiting to be freed */
-    struct thread *th_i;
-    STAILQ_FOREACH(th_i, &g_to_free, to_free_entries)
+    /* A periodic thread keeps running until an earlier deadline is released */
+    if (new_current != NULL && me->period != 0
+        && (new_current->period == 0 || new_current->heap_key >= runqueue_deadline(me, get_time())))
     {
-        free_context(th_i);
+        runq_push_head(new_current);
+        new_current = NULL;
+        start_timeslice(me);
     }
 
-    /* Update scheduler */
-    STAILQ_INSERT_TAIL(&g_runq, g_current_thread, runq_entries);
-    thread *new_current = STAILQ_FIRST(&g_runq);
-    STAILQ_REMOVE_HEAD(&g_runq, runq_entries);
+    if (new_current != NULL)
+    {
+        /* Swapping contexes, the current thread goes back to the run queue after the switch */
+        switch_to(new_current, SWITCH_REQUEUE);
+    }
+#ifndef USE_MN
+    /* Alone: nobody waits for the threads exited to be free'd */
+    else if (runqueue_empty(&g_runq))
+    {
+        reclaim(-1);
+    }
+#endif
+    enable_interruptions();
 
-    /* Swapping contexes */
-    thread *tmp = g_current_thread;
-    g_current_thread = new_current;
+    return EXIT_SUCCESS;
+}
 
-    /* Reset the timer for the new thread */
-    reset_timer();
-    CHECK(swapcontext(tmp->ctx, new_current->ctx), -1, "thread_yield: swapcontext")
+int thread_yield_to(thread_t target)
+{
+    disable_interruptions();
+    LOCK();
+    thread *th = handle_get(target);
+
+    /* Not runnable: running, blocked or finished */
+    if (th == NULL || th == g_current_thread || runq_remove(th) != EXIT_SUCCESS)
+    {
+        UNLOCK();
+        enable_interruptions();
+        thread_yield();
+        return (th != NULL) ? EXIT_SUCCESS : ESRCH;
+    }
+
+    /* No rotation of the run queue: the target runs for the rest of my timeslice,
+     * so that two threads handing off to each other do not keep the processor from the others */
+    switch_to(th, SWITCH_REQUEUE | SWITCH_UNLOCK | SWITCH_DONATE);
     enable_interruptions();
 
     return EXIT_SUCCESS;
@@ -309,44 +1020,81 @@ int thread_yield(void)
 
 int thread_join(thread_t thread, void **retval)
 {
-    struct thread *th = (struct thread *) thread;
+    struct thread *me = g_current_thread;
+    int err = EXIT_SUCCESS;
+    disable_interruptions();
+    LOCK();
 
-    /* Search if the thread does exist => error : ESRCH */
-    // is_existing(th);
+    /* Search if the thread does exist (not joined yet, and on my shard) => error : ESRCH */
+    struct thread *th = handle_get(thread);
+    if (th == NULL)
+        err = ESRCH;
 
-    /* Detecting the deadlock (the thread is waiting for me) => error : EDEADLK */
-    struct thread *me = thread_self();
-    if (th == me->joinq)
-        return EDEADLK;
+    /* Detecting the deadlock (the thread is me or is waiting for me) => error : EDEADLK */
+    else if (th == me || th == me->joinq)
+        err = EDEADLK;
 
-    /* Detecting if the thread is already joined by another thread */
-    if (th->joinq != NULL)
-        return EINVAL;
+    /* Detecting if the thread is already joined by another thread, or cannot be joined */
+    else if (th->joinq != NULL || th->detached == THREAD_CREATE_DETACHED)
+        err = EINVAL;
 
-    /* If the thread has already finished */
-    if (th->status != RUNNING)
+    else
     {
-        disable_interruptions();
+        /* If the thread is alive */
+        /* Sleeping while the thread hasn't finished */
+        if (th->status == RUNNING)
+        {
+            th->joinq = me;
+            /* Wake-up preemption: the thread joined runs right away if it is runnable */
+            if (g_wakeup_preempt && runq_remove(th) == EXIT_SUCCESS)
+                switch_to(th, SWITCH_UNLOCK | SWITCH_DONATE);
+            else
+                block(SWITCH_UNLOCK);
+            LOCK();
+        }
+
+        /* When woke up (thread is finished) */
         finalize_join(th, retval);
-        enable_interruptions();
-        return EXIT_SUCCESS;
     }
 
-    /* If the thread is alive */
-    /* Sleeping while the thread hasn't finished */
-    disable_interruptions();
-    th->joinq = me;
-    struct thread *new_current = STAILQ_FIRST(&g_runq);
-    STAILQ_REMOVE_HEAD(&g_runq, runq_entries);
-    struct thread *tmp = g_current_thread;
-    g_current_thread = new_current;
-    reset_timer();
-    CHECK(swapcontext(tmp->ctx, new_current->ctx), -1, "thread_join: swapcontext")
+    UNLOCK();
     enable_interruptions();
+    return err;
+}
 
-    /* When woke up (thread is finished) */
+int thread_detach(thread_t thread)
+{
     disable_interruptions();
-    finalize_join(th, retval);
+    LOCK();
+
+    /* Already free'd, or on another shard */
+    struct thread *th = handle_get(thread);
+    if (th == NULL)
+    {
+        UNLOCK();
+        enable_interruptions();
+        return ESRCH;
+    }
+
+    /* Already detached, joined by another thread or main */
+    if (th->detached == THREAD_CREATE_DETACHED || th->joinq != NULL || th == g_main_thread)
+    {
+        UNLOCK();
+        enable_interruptions();
+        return EINVAL;
+    }
+
+    /* Already finished: nobody will join it, free it now */
+    if (th->status != RUNNING)
+    {
+        finalize_join(th, NULL);
+    }
+    /* Not joinable anymore: it will free itself when exiting */
+    else
+    {
+        th->detached = THREAD_CREATE_DETACHED;
+    }
+    UNLOCK();
     enable_interruptions();
     return EXIT_SUCCESS;
 }
@@ -354,41 +1102,82 @@ int thread_join(thread_t thread, void **retval)
 __attribute__ ((__noreturn__)) void thread_exit(void *retval)
 {
     disable_interruptions();
-    thread *me = (thread *) thread_self();
+    thread *me = g_current_thread;
+    LOCK();
     me->status = TO_FREE;
 
     /* Set the retval */
-    if (retval) me->rv->value = retval;
+    if (retval && me->detached == THREAD_CREATE_JOINABLE) me->rv.value = retval;
 
     /* Waking up the thread waiting for me */
-    if (me->joinq != NULL)
-        STAILQ_INSERT_TAIL(&g_runq, me->joinq, runq_entries);
+    thread *joiner = me->joinq;
+    if (joiner != NULL)
+        runq_wake(joiner);
+    /* Wake-up preemption: the joiner goes on with the rest of my timeslice, before the others */
+    if (joiner == NULL || !g_wakeup_preempt || runq_remove(joiner) != EXIT_SUCCESS)
+        joiner = NULL;
+
+#ifdef USE_MN
+    thread *main_thread = g_main_thread;
+    /* Main: the process ends once the other threads have exited */
+    if (me == main_thread)
+    {
+        wait_threads();
+        UNLOCK();
+        exit(EXIT_SUCCESS);
+    }
 
-    /* Yielding to next thread if others threads are running*/
-    if (!STAILQ_EMPTY(&g_runq))
+    /* Waking up main if it waits for the last thread */
+    g_nb_alive--;
+    if (g_nb_alive == 0 && g_main_waiting)
     {
-        thread *new_current = STAILQ_FIRST(&g_runq);
-        g_current_thread = new_current;
-        STAILQ_REMOVE_HEAD(&g_runq, runq_entries);
+        g_main_waiting = 0;
+        runq_wake(main_thread);
     }
-    /* Yielding to the thread_main, which is exiting */
+
+    /* Leaving the runqueue, the stack is given back by the next thread */
+    if (joiner != NULL)
+        switch_to(joiner, SWITCH_FREE | SWITCH_UNLOCK | SWITCH_EXIT | SWITCH_DONATE);
     else
+        block(SWITCH_FREE | SWITCH_UNLOCK | SWITCH_EXIT);
+#else
+#ifdef USE_SHARDS
+    if (me != g_main_thread)
+        __atomic_sub_fetch(&g_nb_alive, 1, __ATOMIC_RELAXED);
+#endif
+
+    /* The threads exited before me whose stack is not in the pool, a few at a time */
+    reclaim(RECLAIM_BUDGET);
+
+    /* Yielding to next thread if others threads are running*/
+    thread *new_current = (joiner != NULL) ? joiner : runq_pop_wait();
+    int donate = (joiner != NULL) ? SWITCH_DONATE : 0;
+    /* Yielding to the thread_main, which is exiting */
+    if (new_current == NULL)
+        new_current = g_main_thread;
+
+    /* Stack recycled right away, it stays mapped in the pool until the switch. Detached: nobody will
+     * join me, the structure is recycled too, by the next thread since the switch still charges me */
+    if (me != g_main_thread && pool_keep_stack(me) == EXIT_SUCCESS)
     {
-        g_current_thread = STAILQ_FIRST(&g_all_threads);
+        switch_to(new_current, SWITCH_FREE | SWITCH_EXIT | donate);
     }
-    reset_timer();
-
-    /* Leaving the runqueue */
-    if (me != STAILQ_FIRST(&g_all_threads))
+    /* Leaving the runqueue, freed later by reclaim or by the join */
+    else if (me != g_main_thread)
     {
-        STAILQ_INSERT_TAIL(&g_to_free, me, to_free_entries);
-        CHECK(setcontext(g_current_thread->ctx), -1, "thread_exit: setcontext")
+        STAILQ_INSERT_TAIL(&g_to_free, me, wait_entries);
+        switch_to(new_current, SWITCH_EXIT | donate);
     }
     /* Main */
     else
     {
-        CHECK(swapcontext(me->ctx, g_current_thread->ctx), -1, "thread_exit: swapcontext")
+        switch_to(new_current, 0);
+#ifdef USE_SHARDS
+        /* The threads of the other shards may still be running */
+        wait_threads();
+#endif
     }
+#endif
     exit(EXIT_SUCCESS);
 }
 
@@ -404,11 +1193,18 @@ __attribute__ ((__noreturn__)) void thread_exit(void *retval)
 
 __attribute__ ((constructor)) void thread_create_main(void)
 { 
+#ifdef USE_WORKERS
+    /* The kernel thread starting the process is the first worker */
+    workers_init();
+#endif
+    pool_init();
+    runqueue_policy_init();
+
     /* Initialization of the context */
-    thread *th = init_context(NULL, NULL);
+    thread *th = init_context(NULL, NULL, STACK_SIZE);
 
     /* Initialization of the return value */
-    th->rv = init_retval();
+    th->rv.value = NULL;
 
     /* Initialize the thread's sleep queue */
     th->joinq = NULL;
@@ -416,15 +1212,50 @@ __attribute__ ((constructor)) void thread_create_main(void)
     /* Give a default priority of 5 */
     th->priority.value = 5;
     th->priority.alternate = 0;
+    th->base_priority = th->priority.value;
+    th->nb_inherit = 0;
+    th->nb_read_held = 0;
+    th->blocked_on = NULL;
+    th->period = 0;
+    th->runq = NULL;
+    th->vruntime = 0;
+
+    th->detached = THREAD_CREATE_JOINABLE;
+    strncpy(th->name, "main", THREAD_NAME_SIZE);
+#ifdef USE_SHARDS
+    th->shard = 0;
+#endif
 
     /* Initialization of the queues */
-    STAILQ_INIT(&g_all_threads);
-    STAILQ_INIT(&g_runq);
+    handle_init();
+    park_init();
+#ifndef USE_MN
+    runqueue_init(&g_runq);
+#endif
     STAILQ_INIT(&g_to_free);
 
     /* Add the thread to the scheduler */
     g_current_thread = th;
-    STAILQ_INSERT_HEAD(&g_all_threads, th, all_entries);
+    g_main_thread = th;
+    handle_alloc(th);
+    start_timeslice(NULL);
+
+#ifdef USE_MN
+    /* The idle thread of the first worker needs a stack, main runs on the stack of the process */
+    thread *idle = init_context(NULL, NULL, STACK_SIZE);
+    idle->priority.value = 5;
+    idle->priority.alternate = 0;
+    idle->base_priority = idle->priority.value;
+    idle->nb_inherit = 0;
+    idle->nb_read_held = 0;
+    idle->blocked_on = NULL;
+    idle->period = 0;
+    idle->runq = NULL;
+    idle->detached = THREAD_CREATE_DETACHED;
+    strncpy(idle->name, "idle", THREAD_NAME_SIZE);
+    context_make(idle, idle_start, idle_loop, NULL);
+    get_worker()->idle = idle;
+#endif
 
     /* ---- Setting up the segfault handler ---- */
     segv_stack.ss_sp = valloc(SIGSTKSZ);
@@ -435,12 +1266,12 @@ __attribute__ ((constructor)) void thread_create_main(void)
 
     struct sigaction action;
     bzero(&action, sizeof(action));
-    action.sa_flags = SA_SIGINFO | SA_STACK;
+    /* SA_NODEFER: the handler never returns (thread_exit), so SIGSEGV must not stay blocked
+     * when the register-only switch does not restore the signal mask */
+    action.sa_flags = SA_SIGINFO | SA_STACK | SA_NODEFER;
     action.sa_sigaction = &sigsegv_handler;
     sigaction(SIGSEGV, &action, NULL);
 
-    stack_overflow();
-
     /* ---- Setting up the alarm for preemption ---- */
 
     struct sigaction sa;
@@ -449,93 +1280,86 @@ __attribute__ ((constructor)) void thread_create_main(void)
     /* Install alarm_handler as the signal handler for SIGVTALRM */
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = &alarm_handler;
+#ifdef USE_SOFT_INTERRUPTIONS
+    /* SIGPROF is never blocked: the handler may switch to another thread without returning */
+    sa.sa_flags = SA_NODEFER;
+#endif
     CHECK(sigaction(SIGPROF, &sa, NULL), -1, "thread_create_main: sigaction")
 
-    /* Configure the timer to expire after the timeslice */
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+#ifdef USE_WORKERS
+    /* One timer for each worker */
+    (void) timer;
+    worker_start_timer();
+#ifdef USE_MN
+    workers_start(idle_main);
+#else
+    workers_start(shard_main);
+#endif
+#else
+    /* Configure the timer to expire after a tick */
     timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = TIMESLICE;
-    /* ... and after every timeslice after that */
+    timer.it_value.tv_usec = TICK;
+    /* ... and after every tick after that, the timer is never reset */
     timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = TIMESLICE;
+    timer.it_interval.tv_usec = TICK;
     /* Start a virtual timer. It counts down whenever this process is executing */
-    sigemptyset(&set);
-    sigaddset(&set, SIGPROF);
     CHECK(setitimer(ITIMER_PROF, &timer, NULL), -1, "thread_create_main: setitimer")
+#endif
     enable_interruptions();
 }
 
 __attribute__ ((destructor)) void thread_exit_main(void)
 {
-    thread *th;
-    thread *me = (thread *) thread_self();
+    thread *me = g_current_thread;
     if (me->status == RUNNING)
     {
         disable_interruptions();
+        LOCK();
         me->status = TO_FREE;
 
         /* Set the retval */
-        //if (retval) me->rv->value = retval;
+        //if (retval) me->rv.value = retval;
         // could not be done because no retval when main just does "return" and we can't use force_exit
 
         /* Waking up the thread waiting for me */
         if (me->joinq != NULL)
-            STAILQ_INSERT_TAIL(&g_runq, me->joinq, runq_entries);
-
+            runq_wake(me->joinq);
+
+#ifdef USE_MN
+        /* Waiting for the threads running on all the workers */
+        wait_threads();
+        UNLOCK();
+#elif defined(USE_SHARDS)
+        /* Running the threads of the first shard while waiting for the other shards */
+        wait_threads();
+#else
         /* If others threads are running */
-        while (!STAILQ_EMPTY(&g_runq))
+        thread *new_current;
+        while ((new_current = runq_pop_wait()) != NULL)
         {
-            thread *new_current = STAILQ_FIRST(&g_runq);
-            g_current_thread = new_current;
-            STAILQ_REMOVE_HEAD(&g_runq, runq_entries);
-
-            /* Leaving the runqueue */
-            reset_timer();
-            CHECK(swapcontext(me->ctx, new_current->ctx), -1, "thread_exit_main: swapcontext")
+            switch_to(new_current, 0);
         }
+#endif
         enable_interruptions();
     }
 
     disable_interruptions();
     /* Clean everything */
     thread *main_thread = g_current_thread;
-    thread *th2;
-
-    /* Free the context of the threads exited remaing */
-    th = STAILQ_FIRST(&g_to_free);
-    while (th != NULL)
-    {
-        th2 = STAILQ_NEXT(th, to_free_entries);
-        if (th != main_thread)
-        {
-            free_context(th);
-        }
-        th = th2;
-    }
-    STAILQ_INIT(&g_to_free);
-
-
-    /* Free the remaining things */
-    th = STAILQ_FIRST(&g_all_threads);
-    while (th != NULL)
-    {
-        th2 = STAILQ_NEXT(th, all_entries);
-        if (th != main_thread)
-        {
-            free_join(th);
-        }
-        th = th2;
-    }
+#ifdef USE_WORKERS
+    workers_stop();
+#endif
+#ifdef USE_MN
+    pool_put_stack(get_worker()->idle);
+    pool_put_thread(get_worker()->idle);
+#endif
 
-    VALGRIND_STACK_DEREGISTER(main_thread->valgrind_stackid);
-    mprotect(main_thread->ctx->uc_stack.ss_sp,PAGE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC);
-    free(main_thread->ctx->uc_stack.ss_sp);
-    free(main_thread->ctx);
-    free_retval(main_thread->rv);
-    free(main_thread);
+    pool_put_stack(main_thread);
+    free_threads(main_thread);
 
     free(segv_stack.ss_sp);
-
-    STAILQ_INIT(&g_all_threads);
 }
 
 /*
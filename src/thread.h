@@ -8,6 +8,8 @@
 #endif
 
 #include <sys/queue.h>
+#include <stddef.h>
+#include <time.h>
 __attribute__ ((constructor)) void thread_create_main (void);
 __attribute__ ((destructor)) void thread_exit_main (void);
 
@@ -18,6 +20,8 @@ __attribute__ ((destructor)) void thread_exit_main (void);
  */
 /*!
  * \brief thread_t thread identifier
+ * A handle checked in O(1): once the thread is joined (or has exited, if it is detached) its
+ * identifier designates no thread anymore, even if its resources are reused by a new thread.
  */
 typedef void *thread_t;
 
@@ -30,6 +34,16 @@ typedef void *thread_t;
  */
 extern thread_t thread_self(void);
 
+/*!
+ * \brief gives the identifiers of the threads not free'd yet: running, blocked, or finished and
+ * not joined. With -DUSE_SHARDS, only the threads of the current shard
+ * \fn extern int thread_list(thread_t *threads, int size);
+ * \param threads receives at most size identifiers
+ * \param size the size of threads
+ * \return the number of threads, which may be greater than size
+ */
+extern int thread_list(thread_t *threads, int size);
+
 /* creer un nouveau thread qui va exécuter la fonction func avec l'argument funcarg.
  * renvoie 0 en cas de succès, -1 en cas d'erreur.
  */
@@ -43,6 +57,115 @@ extern thread_t thread_self(void);
  */
 extern int thread_create(thread_t *newthread, void *(*func)(void *), void *funcarg);
 
+/*!
+ * \brief creates a new thread running the function func with arg funcarg on a stack of stack_size bytes
+ * The stack is reserved but only the pages touched by the thread use memory, so a small stack suits
+ * a short handler and a big one a deep recursion. thread_create uses 64 pages.
+ * \fn extern int thread_create_stack(thread_t *newthread, void *(*func)(void *), void *funcarg, size_t stack_size);
+ * \param newthread
+ * \param func the function to run
+ * \param funcarg the arguments to func
+ * \param stack_size the size of the stack in bytes, rounded up to a multiple of the page size
+ * \return 0 on success, EINVAL if stack_size is smaller than 4 pages
+ */
+extern int thread_create_stack(thread_t *newthread, void *(*func)(void *), void *funcarg, size_t stack_size);
+
+#define THREAD_NAME_SIZE 16 /*!< size of a thread name, '\0' included */
+#define THREAD_CREATE_JOINABLE 0 /*!< the thread must be joined (default) */
+#define THREAD_CREATE_DETACHED 1 /*!< the resources of the thread are free'd when it exits, it cannot be joined */
+
+/*!
+ * \struct thread_attr
+ * \brief attributes given to thread_create_ex, initialized by thread_attr_init
+ */
+typedef struct thread_attr
+{
+    size_t stack_size; /*!< size of the stack in bytes, 64 pages by default */
+    unsigned short priority; /*!< between 1 and 10, 5 by default */
+    unsigned int period; /*!< period in microseconds of a periodic thread, 0 by default */
+    unsigned int deadline; /*!< deadline of each job from the start of its period, 0 for the period */
+    int detachstate; /*!< THREAD_CREATE_JOINABLE or THREAD_CREATE_DETACHED */
+    char name[THREAD_NAME_SIZE]; /*!< name of the thread, empty by default */
+} thread_attr_t;
+
+/*!
+ * \brief initializes attr with the default attributes of thread_create
+ * \fn extern int thread_attr_init(thread_attr_t *attr);
+ * \param attr
+ * \return 0
+ */
+extern int thread_attr_init(thread_attr_t *attr);
+
+/*!
+ * \brief sets the size of the stack, see thread_create_stack
+ * \fn extern int thread_attr_setstacksize(thread_attr_t *attr, size_t stack_size);
+ * \param attr
+ * \param stack_size the size of the stack in bytes, rounded up to a multiple of the page size
+ * \return 0 on success, EINVAL if stack_size is smaller than 4 pages
+ */
+extern int thread_attr_setstacksize(thread_attr_t *attr, size_t stack_size);
+
+/*!
+ * \brief sets the priority, see thread_set_priority
+ * \fn extern int thread_attr_setpriority(thread_attr_t *attr, unsigned short priority);
+ * \param attr
+ * \param priority between 1 and 10
+ * \return 0 on success, EINVAL if the priority is not valid
+ */
+extern int thread_attr_setpriority(thread_attr_t *attr, unsigned short priority);
+
+/*!
+ * \brief makes the thread periodic: it runs one job for each period, see thread_wait_period
+ * The periodic threads run before the others, the one of the earliest deadline first (EDF).
+ * The first period starts when the thread is created.
+ * \fn extern int thread_attr_setdeadline(thread_attr_t *attr, unsigned int period, unsigned int deadline);
+ * \param attr
+ * \param period the period in microseconds, 0 for a thread which is not periodic (default)
+ * \param deadline the deadline of each job in microseconds from the start of its period, 0 for the period
+ * \return 0 on success, EINVAL if the deadline is longer than the period
+ */
+extern int thread_attr_setdeadline(thread_attr_t *attr, unsigned int period, unsigned int deadline);
+
+/*!
+ * \brief sets the detach state
+ * \fn extern int thread_attr_setdetachstate(thread_attr_t *attr, int detachstate);
+ * \param attr
+ * \param detachstate THREAD_CREATE_JOINABLE or THREAD_CREATE_DETACHED
+ * \return 0 on success, EINVAL if detachstate is not valid
+ */
+extern int thread_attr_setdetachstate(thread_attr_t *attr, int detachstate);
+
+/*!
+ * \brief sets the name, truncated to THREAD_NAME_SIZE - 1 characters
+ * \fn extern int thread_attr_setname(thread_attr_t *attr, const char *name);
+ * \param attr
+ * \param name
+ * \return 0
+ */
+extern int thread_attr_setname(thread_attr_t *attr, const char *name);
+
+/*!
+ * \brief creates a new thread with the attributes attr, all of them set before the thread is scheduled
+ * \fn extern int thread_create_ex(thread_t *newthread, const thread_attr_t *attr, void *(*func)(void *), void *funcarg);
+ * \param newthread
+ * \param attr the attributes of the thread, NULL for the default ones
+ * \param func the function to run
+ * \param funcarg the arguments to func
+ * \return 0 on success, EINVAL if an attribute is not valid
+ */
+extern int thread_create_ex(thread_t *newthread, const thread_attr_t *attr, void *(*func)(void *), void *funcarg);
+
+/*!
+ * \brief copies the name given to a thread by thread_create_ex ("main" for the main thread), empty if no
+ * name was given. The name is cut to len - 1 characters, a buffer of THREAD_NAME_SIZE holds it whole
+ * \fn extern int thread_get_name(thread_t thread, char *buf, size_t len);
+ * \param thread
+ * \param buf the buffer receiving the name, always ended by '\0'
+ * \param len the size of buf
+ * \return 0 on success, ESRCH if the thread does not exist, EINVAL if len is 0
+ */
+extern int thread_get_name(thread_t thread, char *buf, size_t len);
+
 /* passer la main à un autre thread.
  */
 /*!
@@ -52,6 +175,17 @@ extern int thread_create(thread_t *newthread, void *(*func)(void *), void *funca
  */
 extern int thread_yield(void);
 
+/*!
+ * \brief yields to a given thread, which runs right away if it is runnable: the other threads of the
+ * run queue do not run first. The target runs for the rest of the timeslice of the caller, which
+ * goes back to the run queue as with thread_yield
+ * \fn extern int thread_yield_to(thread_t target);
+ * \param target the thread to run next, thread_yield is done instead if it is running, blocked or
+ * finished
+ * \return 0, ESRCH if the target does not exist (thread_yield is done too)
+ */
+extern int thread_yield_to(thread_t target);
+
 /* attendre la fin d'exécution d'un thread.
  * la valeur renvoyée par le thread est placée dans *retval.
  * si retval est NULL, la valeur de retour est ignorée.
@@ -60,14 +194,26 @@ extern int thread_yield(void);
  */
 /*!
  * \brief wait for a thread to finish
- * only one join can be done per thread. If a join is made on a non-existing thread (i.e not created with thread_create) the comportment will be undefined.
+ * only one join can be done per thread.
  * \fn extern int thread_join(thread_t thread, void **retval);
  * \param thread
  * \param retval
- * \return
+ * \return 0 on success, ESRCH if the thread does not exist (already joined, detached and exited, or
+ * on another shard), EDEADLK if it is the current thread or joins it, EINVAL if it is detached or
+ * already joined by another thread
  */
 extern int thread_join(thread_t thread, void **retval);
 
+/*!
+ * \brief detaches a thread: it cannot be joined anymore and its resources are free'd when it exits
+ * (right away if it has already finished)
+ * \fn extern int thread_detach(thread_t thread);
+ * \param thread
+ * \return 0 on success, ESRCH if the thread does not exist, EINVAL if the thread is already detached,
+ * joined by another thread or is main
+ */
+extern int thread_detach(thread_t thread);
+
 /* terminer le thread courant en renvoyant la valeur de retour retval.
  * cette fonction ne retourne jamais.
  *
@@ -83,90 +229,659 @@ extern int thread_join(thread_t thread, void **retval);
  */
 extern void thread_exit(void *retval) __attribute__ ((__noreturn__));
 
+/*!
+ * \brief gives the number of shards, THREAD_WORKERS with -DUSE_SHARDS and 1 otherwise
+ * \fn extern int thread_shard_count(void);
+ * \return the number of shards
+ */
+extern int thread_shard_count(void);
+
+/*!
+ * \brief gives the shard running the current thread, the threads never change of shard
+ * \fn extern int thread_shard_self(void);
+ * \return between 0 and thread_shard_count() - 1
+ */
+extern int thread_shard_self(void);
+
+/*!
+ * \brief runs func(funcarg) in a new detached thread on the shard given
+ * The thread is sent through a lock-free ring when the shard is not the current one
+ * \fn extern int thread_submit_to(int shard, void *(*func)(void *), void *funcarg);
+ * \param shard between 0 and thread_shard_count() - 1
+ * \param func the function to run
+ * \param funcarg the arguments to func
+ * \return 0 on success, EINVAL if the shard does not exist, EAGAIN if the ring towards it is full
+ */
+extern int thread_submit_to(int shard, void *(*func)(void *), void *funcarg);
+
+/*!
+ * \brief sleeps while the word at addr has the value expected, until thread_wake is called on addr.
+ * The value is checked atomically with the sleep: a thread changing the word, then calling
+ * thread_wake, always wakes up the thread or makes it return EAGAIN. Made for the synchronization
+ * built on a word (lock-free structures, counters): the threads sleeping are kept in a table, by
+ * address. The thread may be woken up while the word still has the value: check it again in a loop.
+ * With -DUSE_SHARDS, only woken up by the threads of its shard
+ * \fn int thread_wait_on(const int *addr, int expected)
+ * \param addr the address of the word
+ * \param expected the value for which the thread sleeps
+ * \return 0 once woken up, EAGAIN if the word does not have the value expected
+ */
+int thread_wait_on(const int *addr, int expected);
+
+/*!
+ * \brief wakes up the threads sleeping in thread_wait_on on addr, in the order they went to sleep
+ * \fn int thread_wake(const int *addr, int nb)
+ * \param addr the address of the word
+ * \param nb the maximum number of threads to wake up, INT_MAX for all of them
+ * \return the number of threads woken up
+ */
+int thread_wake(const int *addr, int nb);
+
 /* Interface possible pour les mutex */
+#define THREAD_MUTEX_BARGING 0 /*!< a thread arriving may take the mutex before the thread woken up by the unlock */
+#define THREAD_MUTEX_HANDOFF 1 /*!< the unlock gives the mutex to the first thread waiting (FIFO) */
+#define THREAD_MUTEX_INHERIT 2 /*!< added to the kind: the possessor runs with the priority of the threads waiting, if higher */
+
 /*!
  * \struct thread_mutex
+ * \brief a mutex: a word taken and released by a compare-and-swap when no thread waits, the
+ * threads waiting sleep in the table of thread_wait_on
  */
 typedef struct thread_mutex
 {
-    thread_t possessor;
-    STAILQ_HEAD(thread_list_mutex, thread) sleep_queue;
+    int state; /*!< unlocked, locked, or locked with threads waiting */
+    int kind; /*!< THREAD_MUTEX_BARGING or THREAD_MUTEX_HANDOFF, with THREAD_MUTEX_INHERIT */
+    thread_t possessor; /*!< the thread holding the mutex, NULL if none */
 } thread_mutex_t;
 
 /*!
- * \brief initiate a mutex
+ * \brief initiate a mutex, THREAD_MUTEX_BARGING
  * \fn int thread_mutex_init(thread_mutex_t *mutex)
  * \param mutex
- * \return
+ * \return 0
  */
 int thread_mutex_init(thread_mutex_t *mutex);
 
 /*!
- * \brief
+ * \brief initiate a mutex of the given kind. THREAD_MUTEX_BARGING lets a running thread take the
+ * mutex again and again without switching, THREAD_MUTEX_HANDOFF serves the threads in the order
+ * they waited. With THREAD_MUTEX_INHERIT added (priority inheritance), a thread waiting raises the possessor
+ * to its priority until the unlock, and the possessor of the mutex the possessor waits for, and so on:
+ * a thread of low priority holding the mutex cannot be left behind threads of a medium priority. The
+ * lock and unlock of such a mutex always go through the critical section of the scheduler
+ * \fn int thread_mutex_init_kind(thread_mutex_t *mutex, int kind)
+ * \param mutex
+ * \param kind THREAD_MUTEX_BARGING or THREAD_MUTEX_HANDOFF, THREAD_MUTEX_INHERIT may be added
+ * \return 0 on success, EINVAL if the kind is unknown
+ */
+int thread_mutex_init_kind(thread_mutex_t *mutex, int kind);
+
+/*!
+ * \brief destroys a mutex
  * \fn int thread_mutex_destroy(thread_mutex_t *mutex)
  * \param mutex
- * \return
+ * \return 0 on success, EBUSY if the mutex is locked or threads wait for it
  */
 int thread_mutex_destroy(thread_mutex_t *mutex);
 
 /*!
- * \brief
+ * \brief locks the mutex, sleeping until it is available. With -DUSE_MN, the mutex is checked a
+ * few times before sleeping, its possessor may be running on another worker
  * \fn int thread_mutex_lock(thread_mutex_t *mutex)
  * \param mutex
- * \return
+ * \return 0 on success, EDEADLK if the current thread holds the mutex
  */
 int thread_mutex_lock(thread_mutex_t *mutex);
 
 /*!
- * \brief
+ * \brief locks the mutex if it is available
+ * \fn int thread_mutex_trylock(thread_mutex_t *mutex)
+ * \param mutex
+ * \return 0 on success, EBUSY if the mutex is locked
+ */
+int thread_mutex_trylock(thread_mutex_t *mutex);
+
+/*!
+ * \brief locks the mutex, waiting until the date at most. The thread sleeps until the unlock wakes
+ * it up or the date has passed, which the tick and the idle loops check: it may wake up one tick late
+ * \fn int thread_mutex_timedlock(thread_mutex_t *mutex, const struct timespec *abstime)
+ * \param mutex
+ * \param abstime the date (CLOCK_REALTIME) after which the thread gives up
+ * \return 0 on success, ETIMEDOUT if the mutex is still locked at the date, EDEADLK for the possessor
+ */
+int thread_mutex_timedlock(thread_mutex_t *mutex, const struct timespec *abstime);
+
+/*!
+ * \brief unlocks the mutex, waking up the first thread waiting for it
  * \fn int thread_mutex_unlock(thread_mutex_t *mutex)
  * \param mutex
- * \return
+ * \return 0 on success, EPERM if the mutex is not locked by the current thread
  */
 int thread_mutex_unlock(thread_mutex_t *mutex);
 
+/*!
+ * \struct thread_cond
+ * \brief a condition variable, the threads waiting for it sleep until it is signaled
+ */
+typedef struct thread_cond
+{
+    thread_mutex_t *mutex; /*!< the mutex given by the threads waiting, they sleep in the table of thread_wait_on */
+} thread_cond_t;
+
+/*!
+ * \brief initializes a condition variable
+ * \fn int thread_cond_init(thread_cond_t *cond)
+ * \param cond
+ * \return 0
+ */
+int thread_cond_init(thread_cond_t *cond);
+
+/*!
+ * \brief destroys a condition variable
+ * \fn int thread_cond_destroy(thread_cond_t *cond)
+ * \param cond
+ * \return 0 on success, EBUSY if threads are waiting for it
+ */
+int thread_cond_destroy(thread_cond_t *cond);
+
+/*!
+ * \brief unlocks the mutex and sleeps until the condition is signaled, then locks the mutex again
+ * All the threads waiting for a condition at the same time must give the same mutex. The thread
+ * may be woken up while the condition it waits for is still false: check it again in a loop.
+ * \fn int thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex)
+ * \param cond
+ * \param mutex locked by the current thread
+ * \return 0 on success, EPERM if the mutex is not locked by the current thread
+ */
+int thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex);
+
+/*!
+ * \brief wakes up the first thread waiting for the condition, if any
+ * \fn int thread_cond_signal(thread_cond_t *cond)
+ * \param cond
+ * \return 0
+ */
+int thread_cond_signal(thread_cond_t *cond);
+
+/*!
+ * \brief wakes up all the threads waiting for the condition. Only the first one runs if the
+ * mutex is available, the others are moved to the threads waiting for the mutex and run one at a time
+ * as it is unlocked
+ * \fn int thread_cond_broadcast(thread_cond_t *cond)
+ * \param cond
+ * \return 0
+ */
+int thread_cond_broadcast(thread_cond_t *cond);
+
+#define THREAD_RWLOCK_PREFER_READER 0 /*!< the readers arriving go before the writers waiting */
+#define THREAD_RWLOCK_PREFER_WRITER 1 /*!< the writers waiting go before the readers arriving */
+
+/*!
+ * \struct thread_rwlock
+ * \brief a reader-writer lock: held by any number of readers, or by one writer
+ */
+typedef struct thread_rwlock
+{
+    int readers; /*!< number of readers holding the lock */
+    thread_t writer; /*!< the writer holding the lock, NULL if none */
+    int kind; /*!< THREAD_RWLOCK_PREFER_READER or THREAD_RWLOCK_PREFER_WRITER */
+    STAILQ_HEAD(thread_list_rwlock_readers, thread) readers_queue;
+    STAILQ_HEAD(thread_list_rwlock_writers, thread) writers_queue;
+} thread_rwlock_t;
+
+/*!
+ * \brief initializes a reader-writer lock. With the reader preference the writers may wait as long
+ * as readers keep coming, with the writer preference the readers may wait as long as writers keep
+ * coming
+ * \fn int thread_rwlock_init(thread_rwlock_t *rwlock, int kind)
+ * \param rwlock
+ * \param kind THREAD_RWLOCK_PREFER_READER or THREAD_RWLOCK_PREFER_WRITER
+ * \return 0 on success, EINVAL if the kind is unknown
+ */
+int thread_rwlock_init(thread_rwlock_t *rwlock, int kind);
+
+/*!
+ * \brief destroys a reader-writer lock
+ * \fn int thread_rwlock_destroy(thread_rwlock_t *rwlock)
+ * \param rwlock
+ * \return 0 on success, EBUSY if the lock is held or threads wait for it
+ */
+int thread_rwlock_destroy(thread_rwlock_t *rwlock);
+
+/*!
+ * \brief takes the lock for reading, waiting while a writer holds it (or waits for it, with the
+ * writer preference). When a writer unlocks, all the readers waiting get the lock at once. A thread
+ * may take it again while it holds it for reading, without waiting for the writers
+ * \fn int thread_rwlock_rdlock(thread_rwlock_t *rwlock)
+ * \param rwlock
+ * \return 0 on success, EDEADLK if the current thread holds the lock for writing, EAGAIN if it already
+ * has RWLOCK_READ_MAX (4) read holds, on any of the locks
+ */
+int thread_rwlock_rdlock(thread_rwlock_t *rwlock);
+
+/*!
+ * \brief takes the lock for writing, waiting while it is held
+ * \fn int thread_rwlock_wrlock(thread_rwlock_t *rwlock)
+ * \param rwlock
+ * \return 0 on success, EDEADLK if the current thread holds the lock, for reading or for writing
+ */
+int thread_rwlock_wrlock(thread_rwlock_t *rwlock);
+
+/*!
+ * \brief releases the lock, held for reading or for writing. Each thread knows the locks it holds for
+ * reading: a thread holding nothing cannot release the hold of a reader
+ * \fn int thread_rwlock_unlock(thread_rwlock_t *rwlock)
+ * \param rwlock
+ * \return 0 on success, EPERM if the lock is not held by the current thread
+ */
+int thread_rwlock_unlock(thread_rwlock_t *rwlock);
+
+/*!
+ * \struct thread_sem
+ * \brief a counting semaphore, a word: the threads waiting sleep in the table of thread_wait_on
+ */
+typedef struct thread_sem
+{
+    int value; /*!< units available */
+} thread_sem_t;
+
+/*!
+ * \brief initializes a semaphore
+ * \fn int thread_sem_init(thread_sem_t *sem, unsigned int value)
+ * \param sem
+ * \param value the number of units available
+ * \return 0 on success, EINVAL if the value is greater than INT_MAX
+ */
+int thread_sem_init(thread_sem_t *sem, unsigned int value);
+
+/*!
+ * \brief destroys a semaphore
+ * \fn int thread_sem_destroy(thread_sem_t *sem)
+ * \param sem
+ * \return 0 on success, EBUSY if threads wait for it
+ */
+int thread_sem_destroy(thread_sem_t *sem);
+
+/*!
+ * \brief takes a unit, sleeping until one is posted if none is available
+ * \fn int thread_sem_wait(thread_sem_t *sem)
+ * \param sem
+ * \return 0
+ */
+int thread_sem_wait(thread_sem_t *sem);
+
+/*!
+ * \brief takes a unit if one is available
+ * \fn int thread_sem_trywait(thread_sem_t *sem)
+ * \param sem
+ * \return 0 on success, EAGAIN if no unit is available
+ */
+int thread_sem_trywait(thread_sem_t *sem);
+
+/*!
+ * \brief gives a unit: hands it to the first thread waiting, if any, which nobody can take it from
+ * \fn int thread_sem_post(thread_sem_t *sem)
+ * \param sem
+ * \return 0
+ */
+int thread_sem_post(thread_sem_t *sem);
+
+/*!
+ * \struct thread_waitgroup
+ * \brief a counter of pending tasks the threads can wait for, to join a group of threads at once.
+ * A word: the threads waiting sleep in the table of thread_wait_on
+ */
+typedef struct thread_waitgroup
+{
+    int count; /*!< number of tasks not done yet */
+} thread_waitgroup_t;
+
+/*!
+ * \brief initializes a wait group, with no task pending
+ * \fn int thread_waitgroup_init(thread_waitgroup_t *wg)
+ * \param wg
+ * \return 0
+ */
+int thread_waitgroup_init(thread_waitgroup_t *wg);
+
+/*!
+ * \brief destroys a wait group
+ * \fn int thread_waitgroup_destroy(thread_waitgroup_t *wg)
+ * \param wg
+ * \return 0 on success, EBUSY if threads wait for it
+ */
+int thread_waitgroup_destroy(thread_waitgroup_t *wg);
+
+/*!
+ * \brief adds tasks to the wait group, before starting them. When the count reaches 0 all the
+ * threads waiting are woken up
+ * \fn int thread_waitgroup_add(thread_waitgroup_t *wg, int delta)
+ * \param wg
+ * \param delta the number of tasks added, negative when they are done
+ * \return 0 on success, EINVAL if the count would be negative
+ */
+int thread_waitgroup_add(thread_waitgroup_t *wg, int delta);
+
+/*!
+ * \brief marks a task as done, same as thread_waitgroup_add(wg, -1)
+ * \fn int thread_waitgroup_done(thread_waitgroup_t *wg)
+ * \param wg
+ * \return 0 on success, EINVAL if no task is pending
+ */
+int thread_waitgroup_done(thread_waitgroup_t *wg);
+
+/*!
+ * \brief sleeps until all the tasks are done: one wake-up for the whole group
+ * \fn int thread_waitgroup_wait(thread_waitgroup_t *wg)
+ * \param wg
+ * \return 0
+ */
+int thread_waitgroup_wait(thread_waitgroup_t *wg);
+
+#define THREAD_CHAN_SEND 0 /*!< operation of a select: send an item */
+#define THREAD_CHAN_RECV 1 /*!< operation of a select: receive an item */
+
+/* The threads waiting on a channel, see chan.c */
+TAILQ_HEAD(thread_chan_waiters, chan_waiter);
+
+/*!
+ * \struct thread_chan
+ * \brief a bounded channel: a ring of items of the same size, copied in and out. A thread sending
+ * to a full channel (or receiving from an empty one) sleeps until a receiver (or a sender) comes,
+ * which gives the item to it directly and wakes it up
+ */
+typedef struct thread_chan
+{
+    char *buffer; /*!< capacity items of item_size bytes, in a ring */
+    size_t item_size;
+    unsigned int capacity;
+    unsigned int head; /*!< index of the oldest item */
+    unsigned int count; /*!< number of items in the ring */
+    int closed;
+    struct thread_chan_waiters senders; /*!< waiting with an item while the ring is full */
+    struct thread_chan_waiters receivers; /*!< waiting for an item while the ring is empty */
+} thread_chan_t;
+
+/*!
+ * \struct thread_chan_op
+ * \brief an operation of thread_chan_select
+ */
+typedef struct thread_chan_op
+{
+    thread_chan_t *chan; /*!< the channel, never ready if NULL */
+    int dir; /*!< THREAD_CHAN_SEND or THREAD_CHAN_RECV */
+    void *item; /*!< the item to send, or where to receive it */
+    int status; /*!< set by thread_chan_select for the operation done: 0, or EPIPE if the channel is closed */
+} thread_chan_op_t;
+
+/*!
+ * \brief initializes a channel of items of the given size. With a capacity of 0 a sender waits for a
+ * receiver and gives the item to it (rendezvous)
+ * \fn int thread_chan_init(thread_chan_t *chan, unsigned int capacity, size_t item_size)
+ * \param chan
+ * \param capacity the maximum number of items sent and not received yet
+ * \param item_size the size of an item in bytes, sizeof the type of the channel
+ * \return 0 on success, EINVAL if item_size is 0, ENOMEM if the ring cannot be allocated
+ */
+int thread_chan_init(thread_chan_t *chan, unsigned int capacity, size_t item_size);
+
+/*!
+ * \brief destroys a channel and frees its ring, the items left are lost
+ * \fn int thread_chan_destroy(thread_chan_t *chan)
+ * \param chan
+ * \return 0 on success, EBUSY if threads wait on it
+ */
+int thread_chan_destroy(thread_chan_t *chan);
+
+/*!
+ * \brief closes a channel: nothing can be sent anymore, the items left can still be received. The
+ * threads waiting are woken up with EPIPE
+ * \fn int thread_chan_close(thread_chan_t *chan)
+ * \param chan
+ * \return 0 on success, EPIPE if the channel is already closed
+ */
+int thread_chan_close(thread_chan_t *chan);
+
+/*!
+ * \brief sends a copy of an item, sleeping while the channel is full. A receiver waiting gets it directly
+ * \fn int thread_chan_send(thread_chan_t *chan, const void *item)
+ * \param chan
+ * \param item the item, item_size bytes
+ * \return 0 on success, EPIPE if the channel is closed
+ */
+int thread_chan_send(thread_chan_t *chan, const void *item);
+
+/*!
+ * \brief receives the oldest item, sleeping while the channel is empty
+ * \fn int thread_chan_recv(thread_chan_t *chan, void *item)
+ * \param chan
+ * \param item where to copy the item, item_size bytes
+ * \return 0 on success, EPIPE if the channel is closed and empty
+ */
+int thread_chan_recv(thread_chan_t *chan, void *item);
+
+/*!
+ * \brief sends several items in order, in one critical section of the scheduler, sleeping whenever the
+ * channel is full
+ * \fn int thread_chan_send_batch(thread_chan_t *chan, const void *items, int nb)
+ * \param chan
+ * \param items nb items, one after the other
+ * \param nb
+ * \return the number of items sent, nb on success, fewer if the channel is closed before all of them
+ * are sent (EPIPE): the first ones are received, the others are not sent
+ */
+int thread_chan_send_batch(thread_chan_t *chan, const void *items, int nb);
+
+/*!
+ * \brief receives the items available, up to nb, sleeping only while the channel is empty
+ * \fn int thread_chan_recv_batch(thread_chan_t *chan, void *items, int nb)
+ * \param chan
+ * \param items room for nb items
+ * \param nb
+ * \return the number of items received, at least 1, 0 if the channel is closed and empty
+ */
+int thread_chan_recv_batch(thread_chan_t *chan, void *items, int nb);
+
+/*!
+ * \brief does the first operation ready among several, in their order, or sleeps on all the channels
+ * until one of them is ready: the thread is woken up by the operation which completes it
+ * \fn int thread_chan_select(thread_chan_op_t *ops, int nb, int wait)
+ * \param ops the operations, the status of the one done is set
+ * \param nb
+ * \param wait 0 to return right away if no operation is ready
+ * \return the index of the operation done, -1 if none is ready and wait is 0 (or no channel is given)
+ */
+int thread_chan_select(thread_chan_op_t *ops, int nb, int wait);
+
 /* Fonction permettant à l'utilisateur de paramétrer la priorité d'un thread
  * L'argument priority doit être compris entre 1 et 10
  * La priorité influe sur le temps d'exécution du thread:
  * -> plus la priorité est élevée, plus la timeslice sera grande
+ * -> les threads de plus haute priorité sont exécutés en premier
  * retourne 0 en cas de succès, 1 si la priorité n'est pas valide
  */
 /*!
  * \brief thread_set_priority allows the user to give a specific priority to a thread. The default priority is 5.
  * \param thread is the thread whose priority you want to change.
  * \param priority is an integer between 1 and 10. The priority of a thread affects its timeslice, ie the higher the priority,
- * the more time the thread will have to execute. If the value given is not valid, the priority is not changed and the user is
- * notified by the return value.
- * \return 0 on success, 1 if the priority given is not valid.
+ * the more time the thread will have to execute. The runnable threads of the highest priority are also run first, a lower
+ * priority skipped for too long is served anyway. The new priority is used the next time the thread is put in the run queue.
+ * A thread holding a mutex with THREAD_MUTEX_INHERIT keeps the priority it inherited until it releases its mutexes.
+ * If the value given is not valid, the priority is not changed and the user is notified by the return value.
+ * \return 0 on success, 1 if the priority given is not valid or the thread does not exist.
  */
 extern int thread_set_priority(thread_t thread, unsigned short priority);
 
 /* Retourne la valeur actuelle de la priorité du thread */
 /*!
- * \brief thread_get_priority returns the current priority of a thread.
+ * \brief thread_get_priority returns the current priority of a thread, the one it inherited while it holds a
+ * mutex with THREAD_MUTEX_INHERIT waited for by a higher priority.
  * \param thread is the thread whose priority you want to know.
- * \return a value between 1 and 10.
+ * \return a value between 1 and 10, 0 if the thread does not exist.
  */
 extern unsigned short thread_get_priority(thread_t thread);
 
+/*!
+ * \brief ends the job of the current period of a periodic thread and waits for the next period
+ * A job done after its deadline is a miss; the jobs whose deadline has passed before they could
+ * start are skipped and counted as misses too. A periodic thread only yields to an earlier deadline.
+ * \fn extern int thread_wait_period(void);
+ * \return 0 on success, EINVAL if the current thread is not periodic
+ */
+extern int thread_wait_period(void);
+
+/*!
+ * \brief gives the number of deadlines missed by a periodic thread
+ * \fn extern unsigned int thread_get_deadline_misses(thread_t thread);
+ * \param thread
+ * \return the number of jobs done late or skipped, 0 if the thread does not exist
+ */
+extern unsigned int thread_get_deadline_misses(thread_t thread);
+
 #else /* USE_PTHREAD */
 
 /* Si on compile avec -DUSE_PTHREAD, ce sont les pthreads qui sont utilisés */
 #include <sched.h>
+#include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #define thread_t pthread_t
 #define thread_self pthread_self
 #define thread_create(th, func, arg) pthread_create(th, NULL, func, arg)
+#define thread_create_ex(th, attr, func, arg) pthread_create(th, attr, func, arg)
 #define thread_yield sched_yield
+#define thread_yield_to(_th) sched_yield()
 #define thread_join pthread_join
+#define thread_detach pthread_detach
 #define thread_exit pthread_exit
 
+/* Attributs de creation, la priorite, le nom et la periode n'ont pas d'equivalent */
+#define THREAD_CREATE_JOINABLE              PTHREAD_CREATE_JOINABLE
+#define THREAD_CREATE_DETACHED              PTHREAD_CREATE_DETACHED
+#define thread_attr_t                       pthread_attr_t
+#define thread_attr_init                    pthread_attr_init
+#define thread_attr_setstacksize            pthread_attr_setstacksize
+#define thread_attr_setdetachstate          pthread_attr_setdetachstate
+#define thread_wait_period                  sched_yield
+
+/* Des fonctions plutot que des macros valant 0: leur resultat peut etre ignore sans avertissement */
+static inline int thread_attr_setpriority(pthread_attr_t *attr, unsigned short priority) { return 0; }
+static inline int thread_attr_setname(pthread_attr_t *attr, const char *name) { return 0; }
+static inline int thread_attr_setdeadline(pthread_attr_t *attr, unsigned int period, unsigned int deadline) { return 0; }
+static inline unsigned int thread_get_deadline_misses(pthread_t thread) { return 0; }
+static inline int thread_list(pthread_t *threads, int size) { return 0; }
+
 /* Interface possible pour les mutex */
 #define thread_mutex_t            pthread_mutex_t
 #define thread_mutex_init(_mutex) pthread_mutex_init(_mutex, NULL)
 #define thread_mutex_destroy      pthread_mutex_destroy
 #define thread_mutex_lock         pthread_mutex_lock
 #define thread_mutex_unlock       pthread_mutex_unlock
+#define THREAD_MUTEX_BARGING      0
+#define THREAD_MUTEX_HANDOFF      1
+#define THREAD_MUTEX_INHERIT      2
+#define thread_mutex_trylock      pthread_mutex_trylock
+#define thread_mutex_timedlock    pthread_mutex_timedlock
+
+/* L'heritage de priorite est le protocole PTHREAD_PRIO_INHERIT, le mode est celui de la bibliotheque */
+static inline int thread_mutex_init_kind(pthread_mutex_t *mutex, int kind)
+{
+    pthread_mutexattr_t attr;
+    int err;
+
+    pthread_mutexattr_init(&attr);
+    if (kind & THREAD_MUTEX_INHERIT)
+        pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    err = pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return err;
+}
+
+/* Variables de condition */
+#define thread_cond_t             pthread_cond_t
+#define thread_cond_init(_cond)   pthread_cond_init(_cond, NULL)
+#define thread_cond_destroy       pthread_cond_destroy
+#define thread_cond_wait          pthread_cond_wait
+#define thread_cond_signal        pthread_cond_signal
+#define thread_cond_broadcast     pthread_cond_broadcast
+
+/* Verrous lecteurs-redacteurs, la preference est celle de la bibliotheque */
+#define THREAD_RWLOCK_PREFER_READER 0
+#define THREAD_RWLOCK_PREFER_WRITER 1
+#define thread_rwlock_t                   pthread_rwlock_t
+#define thread_rwlock_init(_rwlock, _kind) pthread_rwlock_init(_rwlock, NULL)
+#define thread_rwlock_destroy             pthread_rwlock_destroy
+#define thread_rwlock_rdlock              pthread_rwlock_rdlock
+#define thread_rwlock_wrlock              pthread_rwlock_wrlock
+#define thread_rwlock_unlock              pthread_rwlock_unlock
+
+/* Attente sur un mot: le futex du noyau */
+static inline int thread_wait_on(const int *addr, int expected)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0) ? errno : 0;
+}
+
+static inline int thread_wake(const int *addr, int nb)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, nb, NULL, NULL, 0);
+}
+
+/* Semaphores, les erreurs sont rendues comme par les fonctions des threads */
+#define thread_sem_t              sem_t
+#define thread_sem_init(_sem, _v) (sem_init(_sem, 0, _v) ? errno : 0)
+#define thread_sem_destroy(_sem)  (sem_destroy(_sem) ? errno : 0)
+#define thread_sem_wait(_sem)     (sem_wait(_sem) ? errno : 0)
+#define thread_sem_trywait(_sem)  (sem_trywait(_sem) ? errno : 0)
+#define thread_sem_post(_sem)     (sem_post(_sem) ? errno : 0)
+
+/* Groupes d'attente, sans equivalent: un compteur protege par un mutex */
+typedef struct thread_waitgroup
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int count;
+} thread_waitgroup_t;
+
+static inline int thread_waitgroup_init(thread_waitgroup_t *wg)
+{
+    wg->count = 0;
+    pthread_mutex_init(&wg->mutex, NULL);
+    return pthread_cond_init(&wg->cond, NULL);
+}
+
+static inline int thread_waitgroup_destroy(thread_waitgroup_t *wg)
+{
+    int err = pthread_cond_destroy(&wg->cond);
+    if (!err)
+        pthread_mutex_destroy(&wg->mutex);
+    return err;
+}
+
+static inline int thread_waitgroup_add(thread_waitgroup_t *wg, int delta)
+{
+    int err = 0;
+    pthread_mutex_lock(&wg->mutex);
+    if (wg->count + delta < 0)
+        err = EINVAL;
+    else if ((wg->count += delta) == 0)
+        pthread_cond_broadcast(&wg->cond);
+    pthread_mutex_unlock(&wg->mutex);
+    return err;
+}
+
+#define thread_waitgroup_done(_wg) thread_waitgroup_add(_wg, -1)
+
+static inline int thread_waitgroup_wait(thread_waitgroup_t *wg)
+{
+    pthread_mutex_lock(&wg->mutex);
+    while (wg->count > 0)
+        pthread_cond_wait(&wg->cond, &wg->mutex);
+    pthread_mutex_unlock(&wg->mutex);
+    return 0;
+}
 
 #endif /* USE_PTHREAD */
 
@@ -0,0 +1,339 @@
+#include "thread.h"
+
+#ifndef USE_PTHREAD
+#include "define.h"
+
+#ifdef USE_WORKERS
+#include <sched.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+#include "worker.h"
+#include "scheduler.h"
+#include "runqueue.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/*
+ * ##############################################################################################
+ * ######                                Static data                                       ######
+ * ##############################################################################################
+ */
+
+#ifdef USE_MN
+spinlock g_lock = 0;
+#endif
+volatile int g_workers_stop = 0;
+
+static worker *g_workers;
+static int g_nb_workers;
+static void *(*g_worker_main)(void *);
+
+/* The worker of the kernel thread */
+static __thread worker *g_worker __attribute__ ((tls_model ("initial-exec")));
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/* Not inlined and opaque to the compiler: with USE_MN a user thread can be resumed by another
+ * worker, so the worker must be read again after each switch instead of being kept in a register */
+__attribute__ ((noinline)) worker *get_worker()
+{
+    worker *w = g_worker;
+    __asm__ __volatile__ ("" : "+r" (w));
+    return w;
+}
+
+int worker_id()
+{
+    return get_worker()->id;
+}
+
+int worker_count()
+{
+    return g_nb_workers;
+}
+
+#ifdef USE_MN
+
+/*
+ * ##############################################################################################
+ * ######                                  Spinlocks                                       ######
+ * ##############################################################################################
+ */
+
+void spin_lock(spinlock *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    {
+        /* The owner may have been descheduled by the kernel: let it run */
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED))
+            sched_yield();
+    }
+}
+
+void spin_unlock(spinlock *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+/*
+ * ##############################################################################################
+ * ######                                 Run queues                                       ######
+ * ##############################################################################################
+ */
+
+void worker_push(thread *th, int flags)
+{
+    /* The main thread stays on the first worker */
+    worker *w = (th == g_main_thread) ? &g_workers[0] : get_worker();
+    spin_lock(&w->runq_lock);
+    runqueue_push(&w->runq, th, flags);
+    spin_unlock(&w->runq_lock);
+}
+
+int worker_remove(thread *th)
+{
+    /* Main stays on the first worker */
+    if (th == g_main_thread && get_worker() != &g_workers[0])
+        return EXIT_FAILURE;
+
+    struct runqueue *rq;
+    while ((rq = __atomic_load_n(&th->runq, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        worker *w = (worker *) ((char *) rq - offsetof(worker, runq));
+        spin_lock(&w->runq_lock);
+        /* Still there, not taken by its worker in the meantime */
+        if (th->runq == rq)
+        {
+            int err = runqueue_remove(rq, th);
+            spin_unlock(&w->runq_lock);
+            return err;
+        }
+        spin_unlock(&w->runq_lock);
+    }
+    return EXIT_FAILURE;
+}
+
+static thread *worker_take(worker *w, int steal)
+{
+    /* Nothing to take: do not take the lock of a worker for nothing */
+    if (runqueue_empty(&w->runq))
+        return NULL;
+
+    spin_lock(&w->runq_lock);
+    /* Main cannot be stolen */
+    thread *th = runqueue_pop(&w->runq, steal ? g_main_thread : NULL);
+    spin_unlock(&w->runq_lock);
+    return th;
+}
+
+thread *worker_pop()
+{
+    worker *w = get_worker();
+    thread *th = worker_take(w, 0);
+
+    /* Steal from the other workers, starting from the next one */
+    for (int i = 1; th == NULL && i < g_nb_workers; i++)
+    {
+        th = worker_take(&g_workers[(w->id + i) % g_nb_workers], 1);
+    }
+    return th;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_MN */
+
+#ifdef USE_SHARDS
+
+/*
+ * ##############################################################################################
+ * ######                                   Messages                                       ######
+ * ##############################################################################################
+ */
+
+int worker_send(int shard, void *(*func)(void *), void *funcarg)
+{
+    worker *dst = &g_workers[shard];
+    ring *r = &dst->inbox[get_worker()->id];
+
+    /* Only the calling shard writes tail */
+    unsigned int tail = r->tail;
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+        return EAGAIN;
+    r->messages[tail & (RING_SIZE - 1)].func = func;
+    r->messages[tail & (RING_SIZE - 1)].funcarg = funcarg;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    /* The message is visible before the doorbell rings */
+    __atomic_add_fetch(&dst->doorbell, 1, __ATOMIC_RELEASE);
+    return EXIT_SUCCESS;
+}
+
+int worker_receive(message *msg)
+{
+    worker *w = get_worker();
+    unsigned int doorbell = __atomic_load_n(&w->doorbell, __ATOMIC_ACQUIRE);
+    if (doorbell == w->doorbell_seen)
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < g_nb_workers; i++)
+    {
+        ring *r = &w->inbox[i];
+        /* Only the calling shard writes head */
+        unsigned int head = r->head;
+        if (head != __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+        {
+            *msg = r->messages[head & (RING_SIZE - 1)];
+            __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    /* All the rings are empty: the messages announced by doorbell have all been received */
+    w->doorbell_seen = doorbell;
+    return EXIT_FAILURE;
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_SHARDS */
+
+/*
+ * ##############################################################################################
+ * ######                               Kernel threads                                     ######
+ * ##############################################################################################
+ */
+
+void worker_start_timer()
+{
+    worker *w = get_worker();
+    struct sigevent sev;
+    struct itimerspec its;
+
+    /* SIGPROF is sent to this kernel thread only, after each TICK of CPU time */
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    CHECK(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &w->timer), -1, "worker_start_timer: timer_create")
+
+    its.it_value.tv_sec = 0;
+    its.it_value.tv_nsec = TICK * 1000;
+    its.it_interval = its.it_value;
+    CHECK(timer_settime(w->timer, 0, &its, NULL), -1, "worker_start_timer: timer_settime")
+}
+
+static void *worker_main(void *arg)
+{
+    worker *w = (worker *) arg;
+    g_worker = w;
+    /* The worker runs its scheduler, it is never preempted */
+    disable_interruptions();
+
+    /* The segfault handler needs a stack for each kernel thread */
+    w->segv_stack.ss_sp = valloc(SIGSTKSZ);
+    w->segv_stack.ss_flags = 0;
+    w->segv_stack.ss_size = SIGSTKSZ;
+    CHECK(sigaltstack(&w->segv_stack, NULL), -1, "worker_main: sigaltstack")
+
+    g_worker_main(NULL);
+
+    CHECK(timer_delete(w->timer), -1, "worker_main: timer_delete")
+    w->segv_stack.ss_flags = SS_DISABLE;
+    CHECK(sigaltstack(&w->segv_stack, NULL), -1, "worker_main: sigaltstack")
+    free(w->segv_stack.ss_sp);
+    return NULL;
+}
+
+/**
+ * @brief alloc_lines allocates whole cache lines and zeroes them, the process ends if it fails
+ */
+static void *alloc_lines(size_t size)
+{
+    void *ptr;
+    /* The error is returned, not set in errno */
+    int err = posix_memalign(&ptr, CACHE_LINE, size);
+    if (err)
+    {
+        errno = err;
+        perror("workers_init: posix_memalign");
+        exit(EXIT_FAILURE);
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void workers_init()
+{
+    const char *env = getenv("THREAD_WORKERS");
+    g_nb_workers = env ? atoi(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_nb_workers < 1) g_nb_workers = 1;
+
+    /* One cache line per worker */
+    g_workers = alloc_lines(g_nb_workers * sizeof(worker));
+    for (int i = 0; i < g_nb_workers; i++)
+    {
+        g_workers[i].id = i;
+#ifdef USE_MN
+        runqueue_init(&g_workers[i].runq);
+#else
+        /* One ring from each shard */
+        g_workers[i].inbox = alloc_lines(g_nb_workers * sizeof(ring));
+#endif
+    }
+    g_worker = &g_workers[0];
+}
+
+void workers_start(void *(*main)(void *))
+{
+    g_worker_main = main;
+    for (int i = 1; i < g_nb_workers; i++)
+    {
+        int err = pthread_create(&g_workers[i].pthread, NULL, worker_main, &g_workers[i]);
+        if (err)
+        {
+            errno = err;
+            perror("workers_start: pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void workers_stop()
+{
+    g_workers_stop = 1;
+    for (int i = 1; i < g_nb_workers; i++)
+    {
+        pthread_join(g_workers[i].pthread, NULL);
+    }
+    CHECK(timer_delete(g_workers[0].timer), -1, "workers_stop: timer_delete")
+    /* A tick may still be pending */
+    signal(SIGPROF, SIG_IGN);
+#ifdef USE_SHARDS
+    for (int i = 0; i < g_nb_workers; i++)
+    {
+        free(g_workers[i].inbox);
+    }
+#endif
+    free(g_workers);
+}
+
+/*
+ * ______________________________________________________________________________________________
+ */
+
+#endif /* USE_WORKERS */
+
+#endif /* USE_PTHREAD */
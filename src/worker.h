@@ -0,0 +1,128 @@
+/**
+  * \file worker.h
+  * \brief kernel threads running the user threads (USE_MN, USE_SHARDS)
+  *
+  * USE_MN: each worker has its own run queue. A worker with nothing to run switches to its idle
+  * thread, which steals the next threads to run from the run queues of the other workers.
+  * The main thread never migrates: it always runs on the first worker, the kernel thread that
+  * started the process.
+  *
+  * USE_SHARDS: each worker (shard) has its own scheduler and the threads never migrate. The
+  * shards only communicate through rings of messages, one for each pair of shards.
+  */
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "define.h"
+
+#ifdef USE_WORKERS
+
+/**
+ * \var g_workers_stop set when the process ends: the workers return
+ */
+extern volatile int g_workers_stop;
+
+/**
+ * @brief workers_init creates the workers, the calling kernel thread becomes the first one
+ * Their number is read from the environment variable THREAD_WORKERS (number of cores by default)
+ */
+void workers_init();
+
+/**
+ * @brief workers_start starts the kernel threads of the other workers
+ * @param main the function run by the workers with the interruptions disabled, it starts the timer
+ * of the worker once its current thread is set, and returns once g_workers_stop is set
+ */
+void workers_start(void *(*main)(void *));
+
+/**
+ * @brief workers_stop stops the other workers and waits for them, from the first worker
+ * All the user threads must have exited
+ */
+void workers_stop();
+
+/**
+ * @brief worker_start_timer starts the preemption timer of the calling worker
+ * The timer counts the CPU time of the kernel thread and sends SIGPROF to it every TICK
+ */
+void worker_start_timer();
+
+/**
+ * @brief worker_id gives the index of the calling worker
+ * @return between 0 and worker_count() - 1
+ */
+int worker_id();
+
+/**
+ * @brief worker_count gives the number of workers
+ * @return at least 1
+ */
+int worker_count();
+
+#endif /* USE_WORKERS */
+
+#ifdef USE_MN
+
+/**
+ * \var g_lock protects the data shared by the workers, see scheduler.h
+ */
+extern spinlock g_lock;
+
+/**
+ * @brief spin_lock takes the lock, the interruptions must be disabled
+ * @param lock the lock
+ */
+void spin_lock(spinlock *lock);
+
+/**
+ * @brief spin_unlock releases the lock
+ * @param lock the lock
+ */
+void spin_unlock(spinlock *lock);
+
+/**
+ * @brief worker_push puts th in the run queue of the calling worker, of the first one for main
+ * @param th a thread which is not running
+ * @param flags RUNQ_* flags, see runqueue_push
+ */
+void worker_push(thread *th, int flags);
+
+/**
+ * @brief worker_remove takes th out of the run queue of its worker, to run it on the calling one
+ * @param th a thread
+ * @return EXIT_SUCCESS, EXIT_FAILURE if th is in no run queue, or is main and the calling worker
+ * is not the first one
+ */
+int worker_remove(thread *th);
+
+/**
+ * @brief worker_pop removes the next thread to run from the run queue of the calling worker,
+ * or steals one from another worker if it is empty
+ * @return the thread, NULL if there is nothing to run
+ */
+thread *worker_pop();
+
+#endif /* USE_MN */
+
+#ifdef USE_SHARDS
+
+/**
+ * @brief worker_send sends a message to another shard, without any lock
+ * @param shard the index of the shard receiving the message, not the calling one
+ * @param func the function of the thread to create
+ * @param funcarg the argument of func
+ * @return EXIT_SUCCESS on success, EAGAIN if the ring towards the shard is full
+ */
+int worker_send(int shard, void *(*func)(void *), void *funcarg);
+
+/**
+ * @brief worker_receive takes a message sent to the calling shard
+ * Only a load is made when no message has been sent since the last call
+ * @param msg filled with the message
+ * @return EXIT_SUCCESS if a message has been received, EXIT_FAILURE otherwise
+ */
+int worker_receive(message *msg);
+
+#endif /* USE_SHARDS */
+
+#endif // WORKER_H
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../src/thread.h"
+
+/* Test of the stack size given at the creation of a thread
+ *
+ * Many threads are created with a small stack and stay alive at the same time,
+ * then one thread with a big stack makes a deep recursion that would overflow
+ * the default stack (64 pages).
+ *
+ * needed:
+ * - thread_create_stack()
+ * - thread_yield()
+ * - thread_join() with the return value
+ */
+
+#define BIG_STACK (16 * 1024 * 1024)
+#define DEPTH 50000 // about 100 bytes by frame, far more than the default stack
+
+static void * small_func(void *arg)
+{
+  thread_yield();
+  return arg;
+}
+
+static unsigned long recursion(unsigned long n)
+{
+  volatile char frame[64];
+  frame[0] = (char) n;
+  if (n == 0)
+    return frame[0];
+  return 1 + recursion(n - 1) + frame[0] - (char) n;
+}
+
+static void * deep_func(void *arg)
+{
+  return (void *) recursion((unsigned long) arg);
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th, deep;
+  int err, i, nb;
+  void *res;
+  long page_size = sysconf(_SC_PAGE_SIZE);
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(*th));
+  assert(th);
+
+  /* A stack too small for the signal handlers is refused */
+  err = thread_create_stack(&deep, deep_func, NULL, page_size);
+  assert(err == EINVAL);
+
+  for (i = 0; i < nb; i++) {
+    err = thread_create_stack(&th[i], small_func, (void *)(unsigned long) i, 4 * page_size);
+    assert(!err);
+  }
+  for (i = 0; i < nb; i++) {
+    err = thread_join(th[i], &res);
+    assert(!err);
+    assert(res == (void *)(unsigned long) i);
+  }
+
+  err = thread_create_stack(&deep, deep_func, (void *) DEPTH, BIG_STACK);
+  assert(!err);
+  err = thread_join(deep, &res);
+  assert(!err);
+  assert(res == (void *) DEPTH);
+
+  free(th);
+  printf("%d threads with a small stack and 1 thread with a big stack\n", nb);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../src/thread.h"
+
+/* Test of the creation attributes
+ *
+ * The attributes must be set when the thread starts, a detached thread
+ * cannot be joined and its resources are free'd when it exits.
+ *
+ * needed:
+ * - thread_attr_init() and the setters
+ * - thread_create_ex()
+ * - thread_get_priority(), thread_get_name()
+ * - thread_join() on a detached thread
+ */
+
+static int detached_done = 0;
+
+static void * check_attr(void *arg)
+{
+  char name[THREAD_NAME_SIZE];
+
+  assert(thread_get_priority(thread_self()) == 8);
+  assert(!thread_get_name(thread_self(), name, sizeof(name)));
+  assert(strcmp(name, "worker") == 0);
+  return arg;
+}
+
+static void * detached_func(void *arg)
+{
+  detached_done++;
+  return arg;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_attr_t attr;
+  thread_t th;
+  void *res;
+  char name[THREAD_NAME_SIZE];
+  int err, i, nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  assert(!thread_get_name(thread_self(), name, sizeof(name)));
+  assert(strcmp(name, "main") == 0);
+  /* Cut to the size of the buffer */
+  assert(!thread_get_name(thread_self(), name, 3));
+  assert(strcmp(name, "ma") == 0);
+
+  /* Invalid attributes */
+  thread_attr_init(&attr);
+  assert(thread_attr_setpriority(&attr, 11) == EINVAL);
+  assert(thread_attr_setdetachstate(&attr, 42) == EINVAL);
+  assert(thread_attr_setstacksize(&attr, 1) == EINVAL);
+  attr.priority = 0;
+  assert(thread_create_ex(&th, &attr, check_attr, NULL) == EINVAL);
+
+  /* Priority and name set at the creation */
+  thread_attr_init(&attr);
+  assert(thread_attr_setpriority(&attr, 8) == 0);
+  assert(thread_attr_setname(&attr, "worker") == 0);
+  err = thread_create_ex(&th, &attr, check_attr, (void *) 0xbeef);
+  assert(!err);
+  assert(thread_get_priority(th) == 8);
+  err = thread_join(th, &res);
+  assert(!err);
+  assert(res == (void *) 0xbeef);
+
+  /* Detached threads */
+  thread_attr_init(&attr);
+  assert(thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED) == 0);
+  for (i = 0; i < nb; i++) {
+    err = thread_create_ex(&th, &attr, detached_func, NULL);
+    assert(!err);
+    /* ESRCH if it has already exited (USE_MN) */
+    if (i == 0) {
+      err = thread_join(th, NULL);
+      assert(err == EINVAL || err == ESRCH);
+    }
+  }
+  while (detached_done < nb)
+    thread_yield();
+
+  printf("%d detached threads done\n", nb);
+  return 0;
+}
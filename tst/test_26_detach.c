@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "../src/thread.h"
+
+/* Test of thread_detach
+ *
+ * A thread detached while running frees itself when exiting, a thread
+ * detached after its end is free'd right away. Neither can be joined.
+ * Many rounds of short detached threads must not make the memory grow.
+ *
+ * needed:
+ * - thread_create(), thread_create_ex()
+ * - thread_detach()
+ * - thread_yield()
+ */
+
+#define ROUNDS 100
+
+static int done = 0;
+
+static void * func(void *arg)
+{
+  thread_yield();
+  /* the threads may run in parallel (USE_MN) */
+  __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+  return arg;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_attr_t attr;
+  thread_t th;
+  int err, i, j, nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+
+  /* main cannot be detached */
+  assert(thread_detach(thread_self()) == EINVAL);
+
+  /* Detached while running */
+  err = thread_create(&th, func, NULL);
+  assert(!err);
+  assert(thread_detach(th) == 0);
+  /* ESRCH if it has already exited (USE_MN) */
+  err = thread_detach(th);
+  assert(err == EINVAL || err == ESRCH);
+  err = thread_join(th, NULL);
+  assert(err == EINVAL || err == ESRCH);
+  while (done < 1)
+    thread_yield();
+
+  /* Detached once finished */
+  err = thread_create(&th, func, NULL);
+  assert(!err);
+  while (done < 2)
+    thread_yield();
+  assert(thread_detach(th) == 0);
+
+  /* Fire and forget */
+  thread_attr_init(&attr);
+  thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+  for (j = 0; j < ROUNDS; j++) {
+    for (i = 0; i < nb; i++) {
+      err = thread_create_ex(&th, &attr, func, NULL);
+      assert(!err);
+    }
+    while (done < 2 + (j + 1) * nb)
+      thread_yield();
+  }
+
+  printf("%d detached threads done\n", done);
+  return 0;
+}
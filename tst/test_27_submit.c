@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "../src/thread.h"
+
+/* Test of thread_submit_to
+ *
+ * main sends threads to every shard, which send threads to every shard
+ * again. Each thread must run on the shard it has been sent to.
+ * With only one shard (without -DUSE_SHARDS), they are local detached threads.
+ *
+ * needed:
+ * - thread_submit_to(), thread_shard_count(), thread_shard_self()
+ * - thread_yield()
+ */
+
+static int done = 0;
+
+static void submit(int shard, void *(*func)(void *))
+{
+  int err;
+  /* the ring towards the shard is full: let it empty it */
+  while ((err = thread_submit_to(shard, func, (void *) (long) shard)) == EAGAIN)
+    thread_yield();
+  assert(!err);
+}
+
+static void * leaf(void *arg)
+{
+  assert(thread_shard_self() == (int) (long) arg);
+  thread_yield();
+  __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+static void * relay(void *arg)
+{
+  int shard;
+
+  assert(thread_shard_self() == (int) (long) arg);
+  for (shard = 0; shard < thread_shard_count(); shard++)
+    submit(shard, leaf);
+  __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  int i, shard, nb, nb_shards;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  nb_shards = thread_shard_count();
+  assert(nb_shards >= 1);
+  assert(thread_shard_self() == 0);
+
+  assert(thread_submit_to(-1, leaf, NULL) == EINVAL);
+  assert(thread_submit_to(nb_shards, leaf, NULL) == EINVAL);
+
+  for (i = 0; i < nb; i++)
+    for (shard = 0; shard < nb_shards; shard++)
+      submit(shard, relay);
+
+  /* each relay thread sends a leaf thread to every shard */
+  while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < nb * nb_shards * (nb_shards + 1))
+    thread_yield();
+
+  printf("%d threads done on %d shards\n", done, nb_shards);
+  return 0;
+}
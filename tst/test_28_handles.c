@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the thread identifiers
+ *
+ * The identifier of a thread joined designates no thread anymore, even when
+ * a new thread reuses its resources: the functions taking it fail with
+ * ESRCH. thread_list gives the threads not joined yet. The time of a
+ * thread_join failing on a stale identifier is printed for a growing number
+ * of threads alive: it must not grow with it.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_detach()
+ * - thread_self(), thread_list(), thread_yield(), thread_yield_to()
+ * - thread_get_priority(), thread_get_name()
+ */
+
+#define NB_LOOKUPS 100000
+
+static volatile int done = 0;
+
+static void * func(void *arg)
+{
+  while (!done)
+    thread_yield();
+  return arg;
+}
+
+static int listed(thread_t *list, int nb, thread_t th)
+{
+  int i;
+  for (i = 0; i < nb; i++)
+    if (list[i] == th)
+      return 1;
+  return 0;
+}
+
+/* Returns the time of a lookup of a stale identifier in nanoseconds */
+static double lookup(thread_t stale)
+{
+  uint64_t start = now();
+  int i;
+  for (i = 0; i < NB_LOOKUPS; i++)
+    assert(thread_join(stale, NULL) == ESRCH);
+  return (double) (now() - start) / NB_LOOKUPS;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th, *list, stale, reused;
+  char name[THREAD_NAME_SIZE];
+  void *res;
+  int err, i, nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(thread_t));
+  list = malloc((nb + 2) * sizeof(thread_t));
+
+  /* Main alone */
+  assert(thread_list(list, nb + 2) == 1);
+  assert(list[0] == thread_self());
+
+  /* A stale identifier, with a new thread reusing the resources of the thread joined */
+  err = thread_create(&stale, func, NULL);
+  assert(!err);
+  done = 1;
+  assert(thread_join(stale, NULL) == 0);
+  done = 0;
+  err = thread_create(&reused, func, (void *) 0xbeef);
+  assert(!err);
+  assert(reused != stale);
+  assert(thread_join(stale, NULL) == ESRCH);
+  assert(thread_detach(stale) == ESRCH);
+  assert(thread_yield_to(stale) == ESRCH);
+  assert(thread_get_priority(stale) == 0);
+  assert(thread_get_name(stale, name, sizeof(name)) == ESRCH);
+  assert(thread_join(NULL, NULL) == ESRCH);
+  assert(thread_join((thread_t) 0x12345, NULL) == ESRCH);
+  assert(thread_join(thread_self(), NULL) == EDEADLK);
+  printf("%.0f ns per lookup with 2 threads\n", lookup(stale));
+
+  /* All the threads not joined are listed */
+  for (i = 0; i < nb; i++) {
+    err = thread_create(&th[i], func, NULL);
+    assert(!err);
+  }
+  assert(thread_list(list, 1) == nb + 2);
+  assert(thread_list(list, nb + 2) == nb + 2);
+  assert(listed(list, nb + 2, thread_self()) && listed(list, nb + 2, reused));
+  for (i = 0; i < nb; i++)
+    assert(listed(list, nb + 2, th[i]));
+  printf("%.0f ns per lookup with %d threads\n", lookup(stale), nb + 2);
+
+  done = 1;
+  for (i = 0; i < nb; i++)
+    assert(thread_join(th[i], NULL) == 0);
+  assert(thread_join(reused, &res) == 0);
+  assert(res == (void *) 0xbeef);
+  assert(thread_join(reused, NULL) == ESRCH);
+  assert(thread_list(list, nb + 2) == 1);
+
+  free(list);
+  free(th);
+  return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the directed yield, and benchmark of the handoff latency
+ *
+ * Two threads play ping-pong: each one waits for its turn, gives the turn
+ * to the other one and yields, the given number of round trips. Other
+ * threads keep yielding meanwhile. With thread_yield, all of them run
+ * before the other player; with thread_yield_to, the other player runs
+ * right away. The time of a round trip is printed for both, and the number
+ * of times the other threads ran must be lower with thread_yield_to.
+ *
+ * needed:
+ * - thread_create(), thread_join()
+ * - thread_yield(), thread_yield_to()
+ */
+
+static thread_t players[2];
+static volatile int turn;
+static volatile int go;
+static volatile int done;
+static unsigned long others_ran;
+static int directed;
+static int nb_rounds;
+
+static void pass(int id)
+{
+  if (directed)
+    thread_yield_to(players[1 - id]);
+  else
+    thread_yield();
+}
+
+static void * player(void *arg)
+{
+  int id = (int) (long) arg;
+  int i;
+
+  while (!go)
+    thread_yield();
+  for (i = 0; i < nb_rounds; i++) {
+    while (turn != id)
+      pass(id);
+    turn = 1 - id;
+  }
+  /* The other player may still wait for its last turn */
+  pass(id);
+  return NULL;
+}
+
+static void * other(void *arg)
+{
+  while (!done) {
+    __atomic_add_fetch(&others_ran, 1, __ATOMIC_RELAXED);
+    thread_yield();
+  }
+  return NULL;
+}
+
+/* Returns the time of a round trip in nanoseconds, the number of times the other threads ran in *ran */
+static double run(int nb_others, int yield_to, unsigned long *ran)
+{
+  thread_t *th = malloc(nb_others * sizeof(thread_t));
+  uint64_t start, end;
+  int i;
+
+  directed = yield_to;
+  turn = 0;
+  go = 0;
+  done = 0;
+  for (i = 0; i < nb_others; i++)
+    assert(!thread_create(&th[i], other, NULL));
+  for (i = 0; i < 2; i++)
+    assert(!thread_create(&players[i], player, (void *) (long) i));
+
+  others_ran = 0;
+  start = now();
+  go = 1;
+  for (i = 0; i < 2; i++)
+    assert(!thread_join(players[i], NULL));
+  end = now();
+  *ran = others_ran;
+
+  done = 1;
+  for (i = 0; i < nb_others; i++)
+    assert(!thread_join(th[i], NULL));
+  free(th);
+  return (double) (end - start) / nb_rounds;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long ran_yield, ran_yield_to;
+  double yield, yield_to;
+  int nb_others;
+
+  if (argc < 3) {
+    printf("missing arguments: number of other threads, then number of round trips\n");
+    return -1;
+  }
+  nb_others = atoi(argv[1]);
+  nb_rounds = atoi(argv[2]);
+
+  /* Running: a plain yield */
+  assert(!thread_yield_to(thread_self()));
+
+  yield = run(nb_others, 0, &ran_yield);
+  yield_to = run(nb_others, 1, &ran_yield_to);
+  printf("%d round trips, %d other threads: %.0f ns per round trip with thread_yield (others ran %lu times), "
+         "%.0f ns with thread_yield_to (others ran %lu times)\n",
+         nb_rounds, nb_others, yield, ran_yield, yield_to, ran_yield_to);
+  if (nb_others > 0)
+    assert(ran_yield_to < ran_yield);
+
+  return 0;
+}
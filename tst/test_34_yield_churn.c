@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Benchmark of thread_yield while threads keep being created and exiting
+ *
+ * Some threads keep creating bursts of short detached threads, with a stack
+ * of a size the recycling pool does not keep, and yield. The time from a thread_yield
+ * to the next thread running (a thread returning from thread_yield or a new
+ * thread starting) is measured. The median, the 99th percentile and the
+ * maximum are printed: freeing the exited threads must not be charged to
+ * the threads yielding.
+ *
+ * needed:
+ * - thread_create(), thread_create_ex(), thread_attr_setstacksize()
+ * - thread_attr_setdetachstate(), thread_join(), thread_yield()
+ */
+
+#define CHILD_STACK (32 * 4096)
+#define BURST 8
+
+static unsigned long nb_children;
+static uint64_t last; /* date of the last thread_yield, 0 if a thread ran since */
+static uint64_t *times;
+static int nb_times, max_times;
+
+/* Called by each thread resumed or started */
+static void record(void)
+{
+  if (last != 0 && nb_times < max_times)
+    times[nb_times++] = now() - last;
+  last = 0;
+}
+
+static void * child(void *arg)
+{
+  record();
+  return NULL;
+}
+
+static void * spawner(void *arg)
+{
+  thread_attr_t attr;
+  thread_t th;
+  int i;
+
+  thread_attr_init(&attr);
+  thread_attr_setstacksize(&attr, CHILD_STACK);
+  thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+  record();
+  while (nb_times < max_times) {
+    for (i = 0; i < BURST; i++)
+      assert(!thread_create_ex(&th, &attr, child, NULL));
+    nb_children += BURST;
+    last = now();
+    thread_yield();
+    record();
+  }
+  return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+  int nb_spawners, i;
+  thread_t *th;
+
+  if (argc < 3) {
+    printf("missing arguments: number of threads creating threads, then number of yields\n");
+    return -1;
+  }
+  nb_spawners = atoi(argv[1]);
+  max_times = atoi(argv[2]);
+
+  th = malloc(nb_spawners * sizeof(thread_t));
+  times = malloc(max_times * sizeof(uint64_t));
+  for (i = 0; i < nb_spawners; i++)
+    assert(!thread_create(&th[i], spawner, NULL));
+
+  for (i = 0; i < nb_spawners; i++)
+    assert(!thread_join(th[i], NULL));
+
+  qsort(times, nb_times, sizeof(uint64_t), compare);
+  printf("%d threads creating %lu threads: yield p50 %lu ns, p99 %lu ns, max %lu ns\n",
+         nb_spawners, nb_children, (unsigned long) times[nb_times / 2],
+         (unsigned long) times[nb_times * 99 / 100], (unsigned long) times[nb_times - 1]);
+
+  free(times);
+  free(th);
+  return 0;
+}
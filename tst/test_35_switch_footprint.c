@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Benchmark of the context switches when the threads do not fit in the caches
+ *
+ * The given number of threads keep yielding in turn, so that every switch
+ * resumes the thread which ran the longest ago: its thread structure and
+ * the top of its stack are not in the cache anymore. The time of a switch
+ * and, if the processor lets us count them, the L1 data cache misses of a
+ * switch (read misses, user space only) are printed for 10 threads, then
+ * 10 times more until the number given.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_yield()
+ */
+
+static volatile int go;
+static int nb_rounds;
+
+/* Returns a counter of the L1 data cache read misses of the process, -1 if there is none */
+static int open_counter(void)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd)
+{
+  uint64_t value = 0;
+  if (fd >= 0 && read(fd, &value, sizeof(value)) != sizeof(value))
+    value = 0;
+  return value;
+}
+
+static void * yielder(void *arg)
+{
+  int i;
+
+  while (!go)
+    thread_yield();
+  for (i = 0; i < nb_rounds; i++)
+    thread_yield();
+  return NULL;
+}
+
+static void run(int nb, int fd)
+{
+  thread_t *th = malloc(nb * sizeof(thread_t));
+  uint64_t start, end, misses;
+  unsigned long nb_switches;
+  int i;
+
+  go = 0;
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], yielder, NULL));
+  /* Every thread has run once */
+  thread_yield();
+
+  misses = read_counter(fd);
+  start = now();
+  go = 1;
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  end = now();
+  misses = read_counter(fd) - misses;
+
+  /* The yields, the end of each thread and the wake-up of main */
+  nb_switches = (unsigned long) nb * (nb_rounds + 1) + 1;
+  if (fd >= 0)
+    printf("%6d threads: %5.0f ns and %5.1f L1 read misses per switch\n", nb,
+           (double) (end - start) / nb_switches, (double) misses / nb_switches);
+  else
+    printf("%6d threads: %5.0f ns per switch\n", nb, (double) (end - start) / nb_switches);
+  free(th);
+}
+
+int main(int argc, char *argv[])
+{
+  int max, nb, fd;
+
+  if (argc < 3) {
+    printf("missing arguments: maximum number of threads, then number of yields of each thread\n");
+    return -1;
+  }
+  max = atoi(argv[1]);
+  nb_rounds = atoi(argv[2]);
+
+  fd = open_counter();
+  if (fd < 0)
+    printf("no cache miss counter (perf_event_open), only the time is measured\n");
+  for (nb = 10; nb <= max; nb *= 10)
+    run(nb, fd);
+
+  if (fd >= 0)
+    close(fd);
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the wake-up preemption (THREAD_WAKEUP_PREEMPT=1), and benchmark of the fork-join latency
+ *
+ * A thread creates a child doing nothing and joins it, the given number of
+ * times, while other threads keep yielding: the time of a fork-join is
+ * printed. With the wake-up preemption the child runs as soon as it is
+ * joined and the parent as soon as the child exits, without waiting for the
+ * other threads.
+ *
+ * Then a thread of priority 1 unlocks a mutex a thread of priority 10
+ * waits for: with the wake-up preemption and the priority policy, the
+ * thread of priority 10 runs before thread_mutex_unlock returns.
+ *
+ * needed:
+ * - thread_create(), thread_create_ex(), thread_attr_setpriority()
+ * - thread_join(), thread_yield()
+ * - thread_mutex_lock(), thread_mutex_unlock()
+ */
+
+static volatile int done;
+static thread_mutex_t mutex;
+static volatile int high_ran;
+
+static void * nothing(void *arg)
+{
+  return NULL;
+}
+
+static void * other(void *arg)
+{
+  while (!done)
+    thread_yield();
+  return NULL;
+}
+
+static void * high(void *arg)
+{
+  thread_mutex_lock(&mutex);
+  high_ran = 1;
+  thread_mutex_unlock(&mutex);
+  return NULL;
+}
+
+static thread_t create(int priority, void *(*func)(void *))
+{
+  thread_attr_t attr;
+  thread_t th;
+
+  thread_attr_init(&attr);
+  thread_attr_setpriority(&attr, priority);
+  assert(!thread_create_ex(&th, &attr, func, NULL));
+  return th;
+}
+
+static void * low(void *arg)
+{
+  thread_t th;
+  int ran;
+
+  thread_mutex_lock(&mutex);
+  th = create(10, high);
+  /* Until it waits for the mutex */
+  thread_yield();
+  thread_mutex_unlock(&mutex);
+  ran = high_ran;
+  assert(!thread_join(th, NULL));
+  return (void *) (long) ran;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *env = getenv("THREAD_WAKEUP_PREEMPT");
+  const char *policy = getenv("THREAD_SCHED");
+  int preempt = (env != NULL && atoi(env) != 0);
+  int nb_others, nb_forks, i;
+  thread_t *th, child;
+  uint64_t start;
+  void *ran;
+
+  if (argc < 3) {
+    printf("missing arguments: number of other threads, then number of fork-joins\n");
+    return -1;
+  }
+  nb_others = atoi(argv[1]);
+  nb_forks = atoi(argv[2]);
+
+  th = malloc(nb_others * sizeof(thread_t));
+  for (i = 0; i < nb_others; i++)
+    assert(!thread_create(&th[i], other, NULL));
+
+  start = now();
+  for (i = 0; i < nb_forks; i++) {
+    assert(!thread_create(&child, nothing, NULL));
+    assert(!thread_join(child, NULL));
+  }
+  printf("wake-up preemption %s, %d other threads: %.0f ns per fork-join\n",
+         preempt ? "on" : "off", nb_others, (double) (now() - start) / nb_forks);
+
+  done = 1;
+  for (i = 0; i < nb_others; i++)
+    assert(!thread_join(th[i], NULL));
+  free(th);
+
+  thread_mutex_init(&mutex);
+  assert(!thread_join(create(1, low), &ran));
+  thread_mutex_destroy(&mutex);
+  printf("thread of priority 10 run %s the unlock returned\n", ran ? "before" : "after");
+  if (preempt && (policy == NULL || strcmp(policy, "priority") == 0))
+    assert(ran);
+
+  return 0;
+}
@@ -2,14 +2,19 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <assert.h>
 #include "../src/thread.h"
+#include "test_time.h"
 
 /* test de faire une somme avec plein de thread sur un compteur partagé
  *
  * valgrind doit etre content.
  * Le résultat doit etre égal au nombre de threads * 1000.
  * la durée du programme doit etre proportionnelle au nombre de threads donnés en argument.
+ * Le temps d'un verrouillage sans concurrence et d'un verrouillage avec
+ * les threads est affiché, à comparer avec -DUSE_PTHREAD.
  *
  * support nécessaire:
  * - thread_create()
@@ -21,6 +26,8 @@
  * - thread_mutex_unloc()
  */
 
+#define NB_LOCKS 1000000
+
 int counter = 0;
 thread_mutex_t lock;
 
@@ -46,6 +53,7 @@ static void * thfunc(void *dummy __attribute__((unused)))
 int main(int argc, char *argv[])
 {
   thread_t *th;
+  uint64_t start, alone;
   int err, i, nb;
 
   if (argc < 2) {
@@ -66,7 +74,16 @@ int main(int argc, char *argv[])
     return -1;
   }
 
+  /* sans concurrence */
+  start = now();
+  for(i=0; i<NB_LOCKS; i++) {
+    thread_mutex_lock(&lock);
+    thread_mutex_unlock(&lock);
+  }
+  alone = now() - start;
+
   /* on cree tous les threads */
+  start = now();
   for(i=0; i<nb; i++) {
     err = thread_create(&th[i], thfunc, NULL);
     assert(!err);
@@ -83,6 +100,9 @@ int main(int argc, char *argv[])
       assert(!err);
   }
 
+  printf("%.1f ns par verrouillage seul, %.0f ns avec %d threads\n",
+         (double) alone / NB_LOCKS, (double) (now() - start) / (nb * 1000), nb);
+
   free(th);
   thread_mutex_destroy(&lock);
 
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the condition variables
+ *
+ * Producers and consumers exchange items through a bounded buffer, each one
+ * sleeping on a condition while the buffer is full (or empty): every item
+ * must be consumed once, the time of an item is printed. Then threads wait
+ * for a gate opened by a broadcast: all of them must go through, one at a
+ * time with the mutex.
+ *
+ * needed:
+ * - thread_create(), thread_join()
+ * - thread_mutex_init(), thread_mutex_lock(), thread_mutex_unlock()
+ * - thread_cond_init(), thread_cond_destroy(), thread_cond_wait()
+ * - thread_cond_signal(), thread_cond_broadcast()
+ */
+
+#define BUFFER_SIZE 4
+#define NB_ITEMS 10000
+
+static thread_mutex_t mutex;
+static thread_cond_t not_full, not_empty, gate;
+static int buffer[BUFFER_SIZE];
+static int head, count;
+static long consumed_sum;
+static int nb_waiting, open_gate, nb_passed, inside;
+
+static void * producer(void *arg)
+{
+  int nb = (int) (long) arg, i;
+
+  for (i = 1; i <= nb; i++) {
+    thread_mutex_lock(&mutex);
+    while (count == BUFFER_SIZE)
+      assert(!thread_cond_wait(&not_full, &mutex));
+    buffer[(head + count) % BUFFER_SIZE] = i;
+    count++;
+    thread_cond_signal(&not_empty);
+    thread_mutex_unlock(&mutex);
+  }
+  return NULL;
+}
+
+static void * consumer(void *arg)
+{
+  int nb = (int) (long) arg, i;
+
+  for (i = 0; i < nb; i++) {
+    thread_mutex_lock(&mutex);
+    while (count == 0)
+      assert(!thread_cond_wait(&not_empty, &mutex));
+    consumed_sum += buffer[head];
+    head = (head + 1) % BUFFER_SIZE;
+    count--;
+    thread_cond_signal(&not_full);
+    thread_mutex_unlock(&mutex);
+  }
+  return NULL;
+}
+
+static void * waiter(void *arg)
+{
+  thread_mutex_lock(&mutex);
+  nb_waiting++;
+  while (!open_gate)
+    assert(!thread_cond_wait(&gate, &mutex));
+  /* The mutex is held by one thread at a time */
+  assert(!inside);
+  inside = 1;
+  thread_yield();
+  nb_passed++;
+  inside = 0;
+  thread_mutex_unlock(&mutex);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th;
+  uint64_t start;
+  int nb, i;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(2 * nb * sizeof(thread_t));
+
+  thread_mutex_init(&mutex);
+  thread_cond_init(&not_full);
+  thread_cond_init(&not_empty);
+  thread_cond_init(&gate);
+
+#ifndef USE_PTHREAD
+  /* The mutex must be locked */
+  assert(thread_cond_wait(&gate, &mutex) == EPERM);
+#endif
+
+  /* Bounded buffer */
+  start = now();
+  for (i = 0; i < nb; i++) {
+    assert(!thread_create(&th[i], producer, (void *) (long) NB_ITEMS));
+    assert(!thread_create(&th[nb + i], consumer, (void *) (long) NB_ITEMS));
+  }
+  for (i = 0; i < 2 * nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(count == 0);
+  assert(consumed_sum == (long) nb * NB_ITEMS * (NB_ITEMS + 1) / 2);
+  printf("%d producers and %d consumers: %.0f ns per item\n", nb, nb,
+         (double) (now() - start) / ((long) nb * NB_ITEMS));
+
+  /* Broadcast */
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], waiter, NULL));
+  thread_mutex_lock(&mutex);
+  while (nb_waiting < nb) {
+    thread_mutex_unlock(&mutex);
+    thread_yield();
+    thread_mutex_lock(&mutex);
+  }
+#ifndef USE_PTHREAD
+  /* All of them wait */
+  assert(thread_cond_destroy(&gate) == EBUSY);
+#endif
+  open_gate = 1;
+  thread_cond_broadcast(&gate);
+  thread_mutex_unlock(&mutex);
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(nb_passed == nb);
+  printf("%d threads woken up by a broadcast\n", nb_passed);
+
+  assert(!thread_cond_destroy(&gate));
+  assert(!thread_cond_destroy(&not_empty));
+  assert(!thread_cond_destroy(&not_full));
+  thread_mutex_destroy(&mutex);
+  free(th);
+  return 0;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test and benchmark of the reader-writer locks
+ *
+ * The threads read a table and sometimes rewrite it, yielding in the middle
+ * as a lookup which waits: a reader must never see a table half written.
+ * The time of an operation is printed for several ratios of writes, with a
+ * reader-writer lock of each preference and with a mutex, where the readers
+ * wait for each other. Then the readers blocked by a writer must all get the
+ * lock at its unlock, and a reader arriving after a writer waiting must go
+ * after it with the writer preference. The read holds are known to each
+ * thread: only a reader can release its hold, and it can take the lock
+ * again, but not for writing.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_yield()
+ * - thread_mutex_init(), thread_mutex_lock(), thread_mutex_unlock()
+ * - thread_rwlock_init(), thread_rwlock_destroy(), thread_rwlock_rdlock()
+ * - thread_rwlock_wrlock(), thread_rwlock_unlock()
+ */
+
+#define TABLE_SIZE 16
+#define NB_OPS 1000
+
+static thread_rwlock_t rwlock;
+static thread_mutex_t mutex;
+static int use_mutex;
+static int writes_per_mille;
+static int table[TABLE_SIZE];
+static volatile int nb_inside;
+#ifndef USE_PTHREAD
+static volatile int step;
+static int order[2], nb_order;
+#endif
+
+static void * worker(void *arg)
+{
+  unsigned int seed = (unsigned int) (long) arg;
+  int i, j, write;
+
+  for (i = 0; i < NB_OPS; i++) {
+    write = rand_r(&seed) % 1000 < writes_per_mille;
+    if (use_mutex)
+      thread_mutex_lock(&mutex);
+    else if (write)
+      assert(!thread_rwlock_wrlock(&rwlock));
+    else
+      assert(!thread_rwlock_rdlock(&rwlock));
+
+    if (write) {
+      for (j = 0; j < TABLE_SIZE / 2; j++)
+        table[j]++;
+      thread_yield();
+      for (; j < TABLE_SIZE; j++)
+        table[j]++;
+    } else {
+      int first = table[0];
+      thread_yield();
+      for (j = 1; j < TABLE_SIZE; j++)
+        assert(table[j] == first);
+    }
+
+    if (use_mutex)
+      thread_mutex_unlock(&mutex);
+    else
+      assert(!thread_rwlock_unlock(&rwlock));
+  }
+  return NULL;
+}
+
+/* Returns the time of an operation in nanoseconds */
+static double run(thread_t *th, int nb)
+{
+  uint64_t start = now();
+  int i;
+
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], worker, (void *) (long) (i + 1)));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  return (double) (now() - start) / ((long) nb * NB_OPS);
+}
+
+/* Blocked by a writer, then all in at once */
+static void * reader(void *arg)
+{
+  int nb = (int) (long) arg;
+
+  assert(!thread_rwlock_rdlock(&rwlock));
+  __sync_fetch_and_add(&nb_inside, 1);
+  while (nb_inside < nb)
+    thread_yield();
+  assert(!thread_rwlock_unlock(&rwlock));
+  return NULL;
+}
+
+#ifndef USE_PTHREAD
+static void * ordered(void *arg)
+{
+  int write = (int) (long) arg;
+
+  step++;
+  if (write)
+    assert(!thread_rwlock_wrlock(&rwlock));
+  else
+    assert(!thread_rwlock_rdlock(&rwlock));
+  order[__sync_fetch_and_add(&nb_order, 1)] = write;
+  assert(!thread_rwlock_unlock(&rwlock));
+  return NULL;
+}
+
+/* Holds nothing: cannot release the hold of a reader */
+static void * stranger(void *arg)
+{
+  assert(thread_rwlock_unlock(&rwlock) == EPERM);
+  return NULL;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  static const int ratios[] = { 0, 10, 100, 500 };
+  thread_t *th;
+  int nb, i;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(thread_t));
+
+  thread_mutex_init(&mutex);
+  for (i = 0; i < (int) (sizeof(ratios) / sizeof(ratios[0])); i++) {
+    double reader_first, writer_first, mutex_time;
+
+    writes_per_mille = ratios[i];
+    use_mutex = 0;
+    assert(!thread_rwlock_init(&rwlock, THREAD_RWLOCK_PREFER_READER));
+    reader_first = run(th, nb);
+    assert(!thread_rwlock_destroy(&rwlock));
+    assert(!thread_rwlock_init(&rwlock, THREAD_RWLOCK_PREFER_WRITER));
+    writer_first = run(th, nb);
+    assert(!thread_rwlock_destroy(&rwlock));
+    use_mutex = 1;
+    mutex_time = run(th, nb);
+    printf("%4.1f%% writes, %d threads: %5.0f ns per op (readers first), %5.0f ns (writers first), %5.0f ns (mutex)\n",
+           ratios[i] / 10.0, nb, reader_first, writer_first, mutex_time);
+  }
+  thread_mutex_destroy(&mutex);
+
+  /* The readers waiting get the lock together */
+  assert(!thread_rwlock_init(&rwlock, THREAD_RWLOCK_PREFER_WRITER));
+  assert(!thread_rwlock_wrlock(&rwlock));
+#ifndef USE_PTHREAD
+  assert(thread_rwlock_wrlock(&rwlock) == EDEADLK);
+  assert(thread_rwlock_rdlock(&rwlock) == EDEADLK);
+#endif
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], reader, (void *) (long) nb));
+  thread_yield();
+  assert(nb_inside == 0);
+#ifndef USE_PTHREAD
+  assert(thread_rwlock_destroy(&rwlock) == EBUSY);
+#endif
+  assert(!thread_rwlock_unlock(&rwlock));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(nb_inside == nb);
+
+#ifndef USE_PTHREAD
+  assert(thread_rwlock_unlock(&rwlock) == EPERM);
+
+  /* With the writer preference, a reader arriving after a writer waiting goes after it */
+  assert(!thread_rwlock_rdlock(&rwlock));
+  assert(thread_rwlock_wrlock(&rwlock) == EDEADLK);
+  assert(!thread_create(&th[0], stranger, NULL));
+  assert(!thread_join(th[0], NULL));
+  assert(rwlock.readers == 1);
+  assert(!thread_create(&th[0], ordered, (void *) 1));
+  while (step < 1 || STAILQ_EMPTY(&rwlock.writers_queue))
+    thread_yield();
+  /* A reader takes it again without waiting for the writer, which waits for it */
+  assert(!thread_rwlock_rdlock(&rwlock));
+  assert(!thread_rwlock_unlock(&rwlock));
+  assert(!thread_create(&th[1], ordered, (void *) 0));
+  while (step < 2 || STAILQ_EMPTY(&rwlock.readers_queue))
+    thread_yield();
+  assert(!thread_rwlock_unlock(&rwlock));
+  assert(!thread_join(th[0], NULL));
+  assert(!thread_join(th[1], NULL));
+  assert(order[0] == 1 && order[1] == 0);
+
+  /* A thread has a few read holds at most */
+  for (i = 0; i < 4; i++)
+    assert(!thread_rwlock_rdlock(&rwlock));
+  assert(thread_rwlock_rdlock(&rwlock) == EAGAIN);
+  for (i = 0; i < 4; i++)
+    assert(!thread_rwlock_unlock(&rwlock));
+#endif
+  assert(!thread_rwlock_destroy(&rwlock));
+
+  free(th);
+  return 0;
+}
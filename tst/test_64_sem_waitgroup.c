@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the semaphores and of the wait groups
+ *
+ * The threads share a semaphore of SEM_UNITS units: no more than SEM_UNITS
+ * of them hold one at a time, and the units posted go to the threads waiting
+ * in their order, before a thread arriving in the meantime. Then threads are started in bulk and gathered,
+ * once by a thread_join of each, once by a wait group, the main thread and
+ * other threads waiting for it: the time of the gather is printed for both.
+ *
+ * needed:
+ * - thread_create(), thread_create_ex(), thread_attr_setdetachstate()
+ * - thread_join(), thread_yield()
+ * - thread_sem_init(), thread_sem_destroy(), thread_sem_wait()
+ * - thread_sem_trywait(), thread_sem_post()
+ * - thread_waitgroup_init(), thread_waitgroup_destroy(), thread_waitgroup_add()
+ * - thread_waitgroup_done(), thread_waitgroup_wait()
+ */
+
+#define SEM_UNITS 3
+#define NB_WAITERS 4
+
+static thread_sem_t sem;
+static thread_waitgroup_t wg;
+static volatile int nb_holders, max_holders, nb_done;
+
+static void * holder(void *arg)
+{
+  int nb;
+
+  assert(!thread_sem_wait(&sem));
+  nb = __sync_add_and_fetch(&nb_holders, 1);
+  assert(nb <= SEM_UNITS);
+  if (nb > max_holders)
+    max_holders = nb;
+  thread_yield();
+  __sync_fetch_and_sub(&nb_holders, 1);
+  assert(!thread_sem_post(&sem));
+  return NULL;
+}
+
+#ifndef USE_PTHREAD
+static int order[NB_WAITERS], nb_order;
+
+static void * queued(void *arg)
+{
+  assert(!thread_sem_wait(&sem));
+  order[nb_order++] = (int) (long) arg;
+  return NULL;
+}
+#endif
+
+/* Ends after arg yields */
+static void * task(void *arg)
+{
+  int i;
+  for (i = 0; i < (int) (long) arg; i++)
+    thread_yield();
+  __sync_fetch_and_add(&nb_done, 1);
+  return NULL;
+}
+
+static void * grouped_task(void *arg)
+{
+  task(arg);
+  assert(!thread_waitgroup_done(&wg));
+  return NULL;
+}
+
+static void * waiter(void *arg)
+{
+  assert(!thread_waitgroup_wait(&wg));
+  assert(nb_done == (int) (long) arg);
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th, waiters[NB_WAITERS];
+  thread_attr_t attr;
+  uint64_t start;
+  double join_time, wg_time;
+  int nb, i;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(thread_t));
+
+  /* Semaphore */
+  assert(!thread_sem_init(&sem, SEM_UNITS));
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], holder, NULL));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(nb_holders == 0 && max_holders <= SEM_UNITS);
+  for (i = 0; i < SEM_UNITS; i++)
+    assert(!thread_sem_trywait(&sem));
+  assert(thread_sem_trywait(&sem) == EAGAIN);
+  for (i = 0; i < SEM_UNITS; i++)
+    assert(!thread_sem_post(&sem));
+  assert(!thread_sem_destroy(&sem));
+
+#ifndef USE_PTHREAD
+  /* Fairness: the units are handed to the threads waiting, in order */
+  assert(!thread_sem_init(&sem, 0));
+  for (i = 0; i < NB_WAITERS; i++) {
+    assert(!thread_create(&waiters[i], queued, (void *) (long) i));
+    /* It waits for a unit before the next one is created */
+    thread_yield();
+  }
+  for (i = 0; i < NB_WAITERS; i++)
+    assert(!thread_sem_post(&sem));
+#ifndef USE_MN
+  assert(thread_sem_trywait(&sem) == EAGAIN);
+#endif
+  for (i = 0; i < NB_WAITERS; i++)
+    assert(!thread_join(waiters[i], NULL));
+#ifndef USE_MN
+  for (i = 0; i < NB_WAITERS; i++)
+    assert(order[i] == i);
+#endif
+  assert(nb_order == NB_WAITERS);
+  assert(!thread_sem_destroy(&sem));
+#endif
+
+  /* Gathered by joins */
+  start = now();
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], task, (void *) (long) i));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  join_time = (double) (now() - start) / 1000;
+  assert(nb_done == nb);
+
+  /* Gathered by a wait group */
+  nb_done = 0;
+  assert(!thread_waitgroup_init(&wg));
+  assert(thread_waitgroup_done(&wg) == EINVAL);
+  assert(!thread_waitgroup_wait(&wg));
+  for (i = 0; i < NB_WAITERS; i++)
+    assert(!thread_create(&waiters[i], waiter, (void *) (long) nb));
+  thread_attr_init(&attr);
+  thread_attr_setdetachstate(&attr, THREAD_CREATE_DETACHED);
+  start = now();
+  assert(!thread_waitgroup_add(&wg, nb));
+  for (i = 0; i < nb; i++)
+    assert(!thread_create_ex(&th[i], &attr, grouped_task, (void *) (long) i));
+  assert(!thread_waitgroup_wait(&wg));
+  wg_time = (double) (now() - start) / 1000;
+  assert(nb_done == nb);
+  for (i = 0; i < NB_WAITERS; i++)
+    assert(!thread_join(waiters[i], NULL));
+  assert(!thread_waitgroup_destroy(&wg));
+
+  printf("%d threads gathered: %.0f us with thread_join, %.0f us with a wait group\n",
+         nb, join_time, wg_time);
+  free(th);
+  return 0;
+}
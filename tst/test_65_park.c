@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of thread_wait_on and thread_wake
+ *
+ * Threads sleep on the words of an array until each word is set: a wake-up
+ * on a word only wakes up the threads sleeping on it, one at a time or all
+ * of them, whatever the hash of the addresses. Then two threads pass a token
+ * back and forth through a word, sleeping while it is the turn of the other:
+ * the time of a pass is printed, with the size of the synchronization
+ * objects.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_yield()
+ * - thread_wait_on(), thread_wake()
+ */
+
+#define NB_WORDS 64
+#define NB_PASSES 100000
+
+static int words[NB_WORDS];
+static volatile int nb_awake;
+static int turn;
+
+static void * sleeper(void *arg)
+{
+  int *word = arg;
+  while (*(volatile int *) word == 0)
+    thread_wait_on(word, 0);
+  __sync_fetch_and_add(&nb_awake, 1);
+  return NULL;
+}
+
+static void * player(void *arg)
+{
+  int me = (int) (long) arg, i;
+
+  for (i = 0; i < NB_PASSES; i++) {
+    while (*(volatile int *) &turn != me)
+      thread_wait_on(&turn, !me);
+    turn = !me;
+    thread_wake(&turn, 1);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th, players[2];
+  uint64_t start;
+  int nb, i, j;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(NB_WORDS * nb * sizeof(thread_t));
+
+  /* The value has changed */
+  assert(thread_wait_on(&words[0], 1) == EAGAIN);
+  assert(thread_wake(&words[0], INT_MAX) == 0);
+
+  /* nb threads on each word */
+  for (i = 0; i < NB_WORDS * nb; i++)
+    assert(!thread_create(&th[i], sleeper, &words[i % NB_WORDS]));
+  /* They all run and go to sleep, except with USE_MN where they may still be on their way */
+  thread_yield();
+  for (j = 0; j < NB_WORDS; j++) {
+    int before = nb_awake, woken;
+    words[j] = 1;
+    /* One of them, then the others: the threads of the other words stay asleep */
+    woken = thread_wake(&words[j], 1);
+    woken += thread_wake(&words[j], INT_MAX);
+#ifdef USE_MN
+    assert(woken <= nb);
+#else
+    assert(woken == nb);
+#endif
+    while (nb_awake < before + nb)
+      thread_yield();
+    assert(nb_awake == before + nb);
+  }
+  for (i = 0; i < NB_WORDS * nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(nb_awake == NB_WORDS * nb);
+
+  /* Ping-pong */
+  start = now();
+  assert(!thread_create(&players[0], player, (void *) 0));
+  assert(!thread_create(&players[1], player, (void *) 1));
+  assert(!thread_join(players[0], NULL));
+  assert(!thread_join(players[1], NULL));
+  printf("%.0f ns per pass through a word\n", (double) (now() - start) / (2 * NB_PASSES));
+  printf("bytes: %zu (mutex), %zu (cond), %zu (rwlock), %zu (sem), %zu (waitgroup)\n",
+         sizeof(thread_mutex_t), sizeof(thread_cond_t), sizeof(thread_rwlock_t),
+         sizeof(thread_sem_t), sizeof(thread_waitgroup_t));
+
+  free(th);
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of thread_mutex_trylock, thread_mutex_timedlock and of the kinds of mutexes
+ *
+ * A mutex held makes trylock fail, and timedlock once the date has passed;
+ * timedlock succeeds if the mutex is unlocked before the date.
+ * With THREAD_MUTEX_HANDOFF the threads get the mutex in the order they
+ * waited, and the unlock gives it to the first one: the thread unlocking
+ * cannot take it back. With THREAD_MUTEX_BARGING it can. Then the threads
+ * keep taking the mutex, yielding while they hold it: the time of an
+ * operation and the longest wait for the mutex are printed for both kinds.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_yield()
+ * - thread_mutex_init(), thread_mutex_init_kind(), thread_mutex_destroy()
+ * - thread_mutex_lock(), thread_mutex_trylock(), thread_mutex_timedlock()
+ * - thread_mutex_unlock()
+ */
+
+#define NB_OPS 1000
+
+static thread_mutex_t mutex;
+static uint64_t max_wait;
+#ifndef USE_PTHREAD
+static int *order, nb_order;
+#endif
+
+/* The date in ms milliseconds, for timedlock */
+static void date_in(struct timespec *date, long ms)
+{
+  clock_gettime(CLOCK_REALTIME, date);
+  date->tv_nsec += ms * 1000000;
+  date->tv_sec += date->tv_nsec / 1000000000;
+  date->tv_nsec %= 1000000000;
+}
+
+static void * timed(void *arg)
+{
+  struct timespec date;
+  uint64_t start = now();
+
+  date_in(&date, 10);
+  assert(thread_mutex_timedlock(&mutex, &date) == ETIMEDOUT);
+  assert(now() - start >= 10000000);
+  return NULL;
+}
+
+/* The mutex is unlocked long before the date: the unlock wakes the thread up */
+static void * timed_taken(void *arg)
+{
+  struct timespec date;
+
+  date_in(&date, 10000);
+  assert(!thread_mutex_timedlock(&mutex, &date));
+  assert(!thread_mutex_unlock(&mutex));
+  return NULL;
+}
+
+#ifndef USE_PTHREAD
+static void * queued(void *arg)
+{
+  assert(!thread_mutex_lock(&mutex));
+  order[nb_order++] = (int) (long) arg;
+  assert(!thread_mutex_unlock(&mutex));
+  return NULL;
+}
+
+static void check_kinds(thread_t *th, int nb)
+{
+  int i;
+
+  order = malloc(nb * sizeof(int));
+  /* Handoff: in the order they waited, the thread unlocking cannot take the mutex back */
+  assert(!thread_mutex_init_kind(&mutex, THREAD_MUTEX_HANDOFF));
+  assert(!thread_mutex_lock(&mutex));
+  for (i = 0; i < nb; i++) {
+    assert(!thread_create(&th[i], queued, (void *) (long) i));
+    /* It waits for the mutex before the next one is created */
+    thread_yield();
+  }
+  assert(!thread_mutex_unlock(&mutex));
+  assert(thread_mutex_trylock(&mutex) == EBUSY);
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+#ifndef USE_MN
+  for (i = 0; i < nb; i++)
+    assert(order[i] == i);
+#endif
+  assert(nb_order == nb);
+  assert(!thread_mutex_destroy(&mutex));
+
+  /* Barging: the thread unlocking takes the mutex back before the thread woken up runs */
+  nb_order = 0;
+  assert(!thread_mutex_init_kind(&mutex, THREAD_MUTEX_BARGING));
+  assert(!thread_mutex_lock(&mutex));
+  assert(!thread_create(&th[0], queued, (void *) 0));
+  thread_yield();
+  assert(!thread_mutex_unlock(&mutex));
+#ifndef USE_MN
+  assert(!thread_mutex_trylock(&mutex));
+  assert(!thread_mutex_unlock(&mutex));
+#endif
+  assert(!thread_join(th[0], NULL));
+  assert(nb_order == 1);
+  assert(!thread_mutex_destroy(&mutex));
+  free(order);
+}
+#endif
+
+static void * worker(void *arg)
+{
+  uint64_t start, wait;
+  int i;
+
+  for (i = 0; i < NB_OPS; i++) {
+    start = now();
+    assert(!thread_mutex_lock(&mutex));
+    wait = now() - start;
+    if (wait > max_wait)
+      max_wait = wait;
+    thread_yield();
+    assert(!thread_mutex_unlock(&mutex));
+  }
+  return NULL;
+}
+
+/* Prints the time of an operation and the longest wait */
+static void run(thread_t *th, int nb, int kind)
+{
+  uint64_t start;
+  int i;
+
+  assert(!thread_mutex_init_kind(&mutex, kind));
+  max_wait = 0;
+  start = now();
+  for (i = 0; i < nb; i++)
+    assert(!thread_create(&th[i], worker, NULL));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  printf("%s, %d threads: %.0f ns per op, longest wait %lu us\n",
+         kind == THREAD_MUTEX_HANDOFF ? "handoff" : "barging", nb,
+         (double) (now() - start) / ((long) nb * NB_OPS), (unsigned long) (max_wait / 1000));
+  assert(!thread_mutex_destroy(&mutex));
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th;
+  int nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(thread_t));
+
+  /* trylock and timedlock */
+  assert(!thread_mutex_init(&mutex));
+  assert(!thread_mutex_trylock(&mutex));
+  assert(thread_mutex_trylock(&mutex) == EBUSY);
+#ifndef USE_PTHREAD
+  assert(thread_mutex_lock(&mutex) == EDEADLK);
+  assert(thread_mutex_destroy(&mutex) == EBUSY);
+#endif
+  assert(!thread_create(&th[0], timed, NULL));
+  assert(!thread_join(th[0], NULL));
+  assert(!thread_create(&th[0], timed_taken, NULL));
+  thread_yield();
+  assert(!thread_mutex_unlock(&mutex));
+  assert(!thread_join(th[0], NULL));
+#ifndef USE_PTHREAD
+  assert(thread_mutex_unlock(&mutex) == EPERM);
+  assert(thread_mutex_init_kind(&mutex, 42) == EINVAL);
+#endif
+  assert(!thread_mutex_destroy(&mutex));
+
+#ifndef USE_PTHREAD
+  check_kinds(th, nb);
+#endif
+
+  /* Throughput and fairness */
+  run(th, nb, THREAD_MUTEX_BARGING);
+  run(th, nb, THREAD_MUTEX_HANDOFF);
+
+  free(th);
+  return 0;
+}
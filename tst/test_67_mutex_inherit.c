@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the priority inheritance of the mutexes
+ *
+ * A thread of priority 1 holds a mutex while threads of priority 5 keep
+ * yielding, then a thread of priority 10 waits for the mutex: without
+ * inheritance the possessor only runs when the aging of the run queue
+ * serves its priority, with THREAD_MUTEX_INHERIT it runs with priority 10
+ * and the waiter gets the mutex sooner. The time waited by the thread of
+ * priority 10 (the inversion) is printed for both. Then the priority is
+ * inherited through a chain of mutexes, and given back by the unlock.
+ *
+ * needed:
+ * - thread_create(), thread_create_ex(), thread_attr_setpriority()
+ * - thread_join(), thread_yield(), thread_self()
+ * - thread_get_priority(), thread_set_priority()
+ * - thread_mutex_init_kind(), thread_mutex_destroy()
+ * - thread_mutex_lock(), thread_mutex_unlock()
+ */
+
+#define NB_STEPS 100 // yields of the possessor with the mutex held
+#define NB_TRIES 1000 // yields before giving up on a priority
+
+static thread_mutex_t mutex, other;
+static volatile int locked, waiting, done;
+static unsigned short max_priority;
+static uint64_t inversion;
+
+static thread_t create(void *(*func)(void *), void *arg, unsigned short priority)
+{
+  thread_attr_t attr;
+  thread_t th;
+
+  thread_attr_init(&attr);
+  assert(!thread_attr_setpriority(&attr, priority));
+  assert(!thread_create_ex(&th, &attr, func, arg));
+  return th;
+}
+
+/* Priority 1: holds the mutex once the waiter is there */
+static void * low(void *arg)
+{
+  unsigned short priority;
+  int i;
+
+  assert(!thread_mutex_lock(&mutex));
+  locked = 1;
+  while (!waiting)
+    thread_yield();
+  for (i = 0; i < NB_STEPS; i++) {
+    priority = thread_get_priority(thread_self());
+    if (priority > max_priority)
+      max_priority = priority;
+    thread_yield();
+  }
+  assert(!thread_mutex_unlock(&mutex));
+  assert(thread_get_priority(thread_self()) == 1);
+  return NULL;
+}
+
+/* Priority 5: keeps the processor until the waiter got the mutex */
+static void * medium(void *arg)
+{
+  while (!done)
+    thread_yield();
+  return NULL;
+}
+
+/* Priority 10: waits for the mutex */
+static void * high(void *arg)
+{
+  uint64_t start = now();
+
+  waiting = 1;
+  assert(!thread_mutex_lock(&mutex));
+  inversion = now() - start;
+  done = 1;
+  assert(!thread_mutex_unlock(&mutex));
+  return NULL;
+}
+
+/* Returns the time waited by the thread of priority 10, in nanoseconds */
+static uint64_t run(thread_t *th, int nb, int kind)
+{
+  thread_t th_low, th_high;
+  int i;
+
+  assert(!thread_mutex_init_kind(&mutex, kind));
+  locked = waiting = done = 0;
+  max_priority = 0;
+
+  th_low = create(low, NULL, 1);
+  while (!locked)
+    thread_yield();
+  for (i = 0; i < nb; i++)
+    th[i] = create(medium, NULL, 5);
+  th_high = create(high, NULL, 10);
+
+  assert(!thread_join(th_high, NULL));
+  assert(!thread_join(th_low, NULL));
+  for (i = 0; i < nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(!thread_mutex_destroy(&mutex));
+  return inversion;
+}
+
+/* Priority 7: holds other, then waits for mutex held by main */
+static void * middle(void *arg)
+{
+  assert(!thread_mutex_lock(&other));
+  assert(!thread_mutex_lock(&mutex));
+  assert(!thread_mutex_unlock(&mutex));
+  assert(!thread_mutex_unlock(&other));
+  return NULL;
+}
+
+/* Priority 9: waits for other */
+static void * top(void *arg)
+{
+  assert(!thread_mutex_lock(&other));
+  assert(!thread_mutex_unlock(&other));
+  return NULL;
+}
+
+/* Yields until the current thread has the priority, asserts if it never comes */
+static void wait_priority(unsigned short priority)
+{
+  int i;
+  for (i = 0; i < NB_TRIES && thread_get_priority(thread_self()) != priority; i++)
+    thread_yield();
+  assert(thread_get_priority(thread_self()) == priority);
+}
+
+int main(int argc, char *argv[])
+{
+  thread_t *th, th_middle, th_top;
+  uint64_t without, with;
+  int nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  th = malloc(nb * sizeof(thread_t));
+
+  /* Inversion */
+  without = run(th, nb, THREAD_MUTEX_BARGING);
+  assert(max_priority == 1);
+  with = run(th, nb, THREAD_MUTEX_BARGING | THREAD_MUTEX_INHERIT);
+#ifndef USE_MN
+  /* With several workers the waiter may come once the possessor is done */
+  assert(max_priority == 10);
+#endif
+  printf("priority 10 waiting for priority 1, %d threads of priority 5: %lu us without inheritance, %lu us with\n",
+         nb, (unsigned long) (without / 1000), (unsigned long) (with / 1000));
+
+  /* Through a chain: main holds mutex, middle holds other and waits for mutex, top waits for other */
+  assert(!thread_mutex_init_kind(&mutex, THREAD_MUTEX_HANDOFF | THREAD_MUTEX_INHERIT));
+  assert(!thread_mutex_init_kind(&other, THREAD_MUTEX_HANDOFF | THREAD_MUTEX_INHERIT));
+  assert(thread_mutex_init_kind(&other, 4 | THREAD_MUTEX_INHERIT) == EINVAL);
+  assert(!thread_mutex_lock(&mutex));
+  th_middle = create(middle, NULL, 7);
+  wait_priority(7);
+  th_top = create(top, NULL, 9);
+  wait_priority(9);
+  /* Lowered by the user: kept until the unlock */
+  assert(!thread_set_priority(thread_self(), 3));
+  assert(thread_get_priority(thread_self()) == 9);
+  assert(!thread_mutex_unlock(&mutex));
+  assert(thread_get_priority(thread_self()) == 3);
+  assert(!thread_join(th_middle, NULL));
+  assert(!thread_join(th_top, NULL));
+  assert(!thread_set_priority(thread_self(), 5));
+  assert(!thread_mutex_destroy(&mutex));
+  assert(!thread_mutex_destroy(&other));
+
+  free(th);
+  return 0;
+}
@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test and benchmark of the channels
+ *
+ * Items go through a channel in order, a channel of capacity 0 is a
+ * rendezvous, a closed channel gives its items left and then EPIPE (a batch
+ * cut by the close tells how many items were sent), and a
+ * select takes the first operation ready or sleeps on all its channels.
+ * Then the given number of messages go through a pipeline of the given
+ * number of stages, each one a thread receiving from the previous stage
+ * and sending to the next: with channels, with channels and batches, and
+ * with queues of a mutex where the threads yield while the queue is full
+ * or empty. The time of a
+ * message (throughput) and the time from its sending to the end of the
+ * pipeline (latency) are printed for each.
+ *
+ * needed:
+ * - thread_create(), thread_join(), thread_yield()
+ * - thread_mutex_init(), thread_mutex_lock(), thread_mutex_unlock()
+ * - thread_chan_init(), thread_chan_destroy(), thread_chan_close()
+ * - thread_chan_send(), thread_chan_recv(), thread_chan_send_batch()
+ * - thread_chan_recv_batch(), thread_chan_select()
+ */
+
+#define CAPACITY 16
+#define BATCH 8
+
+/* Queue of a mutex, the threads yield while it is full or empty */
+struct queue
+{
+  thread_mutex_t mutex;
+  uint64_t items[CAPACITY];
+  int head, count;
+};
+
+static void queue_put(struct queue *q, uint64_t item)
+{
+  thread_mutex_lock(&q->mutex);
+  while (q->count == CAPACITY) {
+    thread_mutex_unlock(&q->mutex);
+    thread_yield();
+    thread_mutex_lock(&q->mutex);
+  }
+  q->items[(q->head + q->count) % CAPACITY] = item;
+  q->count++;
+  thread_mutex_unlock(&q->mutex);
+}
+
+static uint64_t queue_get(struct queue *q)
+{
+  uint64_t item;
+
+  thread_mutex_lock(&q->mutex);
+  while (q->count == 0) {
+    thread_mutex_unlock(&q->mutex);
+    thread_yield();
+    thread_mutex_lock(&q->mutex);
+  }
+  item = q->items[q->head];
+  q->head = (q->head + 1) % CAPACITY;
+  q->count--;
+  thread_mutex_unlock(&q->mutex);
+  return item;
+}
+
+/* A stage of the pipeline reads from links[i] and writes to links[i + 1] */
+static thread_chan_t *chans;
+static struct queue *queues;
+static int nb_stages, nb_msgs;
+static uint64_t latency;
+
+/* The messages are their date of sending, 0 ends the pipeline of queues */
+static void * chan_source(void *arg)
+{
+  uint64_t date;
+  int i;
+
+  for (i = 0; i < nb_msgs; i++) {
+    date = now();
+    assert(!thread_chan_send(&chans[0], &date));
+  }
+  assert(!thread_chan_close(&chans[0]));
+  return NULL;
+}
+
+static void * chan_stage(void *arg)
+{
+  int i = (int) (long) arg;
+  uint64_t date;
+
+  while (!thread_chan_recv(&chans[i], &date))
+    assert(!thread_chan_send(&chans[i + 1], &date));
+  assert(!thread_chan_close(&chans[i + 1]));
+  return NULL;
+}
+
+static void * chan_sink(void *arg)
+{
+  uint64_t date;
+  int nb = 0;
+
+  while (!thread_chan_recv(&chans[nb_stages], &date)) {
+    latency += now() - date;
+    nb++;
+  }
+  assert(nb == nb_msgs);
+  return NULL;
+}
+
+static void * batch_source(void *arg)
+{
+  uint64_t dates[BATCH];
+  int i, j, nb;
+
+  for (i = 0; i < nb_msgs; i += nb) {
+    nb = (nb_msgs - i < BATCH) ? nb_msgs - i : BATCH;
+    for (j = 0; j < nb; j++)
+      dates[j] = now();
+    assert(thread_chan_send_batch(&chans[0], dates, nb) == nb);
+  }
+  assert(!thread_chan_close(&chans[0]));
+  return NULL;
+}
+
+static void * batch_stage(void *arg)
+{
+  int i = (int) (long) arg, nb;
+  uint64_t dates[BATCH];
+
+  while ((nb = thread_chan_recv_batch(&chans[i], dates, BATCH)) > 0)
+    assert(thread_chan_send_batch(&chans[i + 1], dates, nb) == nb);
+  assert(!thread_chan_close(&chans[i + 1]));
+  return NULL;
+}
+
+static void * batch_sink(void *arg)
+{
+  uint64_t dates[BATCH], end;
+  int nb, total = 0, j;
+
+  while ((nb = thread_chan_recv_batch(&chans[nb_stages], dates, BATCH)) > 0) {
+    end = now();
+    for (j = 0; j < nb; j++)
+      latency += end - dates[j];
+    total += nb;
+  }
+  assert(total == nb_msgs);
+  return NULL;
+}
+
+static void * queue_source(void *arg)
+{
+  int i;
+
+  for (i = 0; i < nb_msgs; i++)
+    queue_put(&queues[0], now());
+  queue_put(&queues[0], 0);
+  return NULL;
+}
+
+static void * queue_stage(void *arg)
+{
+  int i = (int) (long) arg;
+  uint64_t date;
+
+  do {
+    date = queue_get(&queues[i]);
+    queue_put(&queues[i + 1], date);
+  } while (date != 0);
+  return NULL;
+}
+
+static void * queue_sink(void *arg)
+{
+  uint64_t date;
+  int nb = 0;
+
+  while ((date = queue_get(&queues[nb_stages])) != 0) {
+    latency += now() - date;
+    nb++;
+  }
+  assert(nb == nb_msgs);
+  return NULL;
+}
+
+/* Prints the time of a message and its latency through the pipeline */
+static void run(const char *name, void *(*source)(void *), void *(*stage)(void *), void *(*sink)(void *))
+{
+  thread_t *th = malloc((nb_stages + 2) * sizeof(thread_t));
+  uint64_t start = now();
+  int i;
+
+  latency = 0;
+  assert(!thread_create(&th[0], source, NULL));
+  for (i = 0; i < nb_stages; i++)
+    assert(!thread_create(&th[i + 1], stage, (void *) (long) i));
+  assert(!thread_create(&th[nb_stages + 1], sink, NULL));
+  for (i = 0; i < nb_stages + 2; i++)
+    assert(!thread_join(th[i], NULL));
+  printf("%-14s %d stages: %5.0f ns per message, latency %6.1f us\n", name, nb_stages,
+         (double) (now() - start) / nb_msgs, (double) latency / nb_msgs / 1000);
+  free(th);
+}
+
+/* Channels of the checks */
+static thread_chan_t a, b;
+
+static void * rendezvous(void *arg)
+{
+  int item = 42;
+  assert(!thread_chan_send(&a, &item));
+  return NULL;
+}
+
+static void * late_sender(void *arg)
+{
+  int item = (int) (long) arg;
+  thread_yield();
+  assert(!thread_chan_send(&b, &item));
+  return NULL;
+}
+
+static void * closer(void *arg)
+{
+  assert(!thread_chan_close(arg));
+  return NULL;
+}
+
+/* Closes the channel once it is full: the batch sent is cut there */
+static void * full_closer(void *arg)
+{
+  thread_chan_t *chan = arg;
+  while (chan->count < chan->capacity)
+    thread_yield();
+  assert(!thread_chan_close(chan));
+  return NULL;
+}
+
+static void check(void)
+{
+  thread_chan_op_t ops[2];
+  thread_t th;
+  int i, item, items[CAPACITY];
+
+  assert(thread_chan_init(&a, 4, 0) == EINVAL);
+
+  /* In order, then EPIPE once closed and empty */
+  assert(!thread_chan_init(&a, 4, sizeof(int)));
+  for (i = 0; i < 3; i++)
+    assert(!thread_chan_send(&a, &i));
+  assert(!thread_chan_close(&a));
+  assert(thread_chan_close(&a) == EPIPE);
+  assert(thread_chan_send(&a, &i) == EPIPE);
+  for (i = 0; i < 3; i++) {
+    assert(!thread_chan_recv(&a, &item));
+    assert(item == i);
+  }
+  assert(thread_chan_recv(&a, &item) == EPIPE);
+  assert(!thread_chan_destroy(&a));
+
+  /* Rendezvous */
+  assert(!thread_chan_init(&a, 0, sizeof(int)));
+  assert(!thread_create(&th, rendezvous, NULL));
+  assert(!thread_chan_recv(&a, &item));
+  assert(item == 42);
+  assert(!thread_join(th, NULL));
+  assert(!thread_chan_destroy(&a));
+
+  /* Batches: the items available, at least one */
+  assert(!thread_chan_init(&a, CAPACITY, sizeof(int)));
+  for (i = 0; i < CAPACITY; i++)
+    items[i] = i;
+  assert(thread_chan_send_batch(&a, items, 5) == 5);
+  assert(thread_chan_recv_batch(&a, items, CAPACITY) == 5);
+  assert(items[0] == 0 && items[4] == 4);
+
+  /* Select: nothing ready, then the sender of b wakes it up */
+  assert(!thread_chan_init(&b, 0, sizeof(int)));
+  ops[0].chan = &a;
+  ops[0].dir = THREAD_CHAN_RECV;
+  ops[0].item = &item;
+  ops[1].chan = &b;
+  ops[1].dir = THREAD_CHAN_RECV;
+  ops[1].item = &item;
+  assert(thread_chan_select(ops, 2, 0) == -1);
+  assert(!thread_create(&th, late_sender, (void *) 7));
+  assert(thread_chan_select(ops, 2, 1) == 1);
+  assert(ops[1].status == 0 && item == 7);
+  assert(!thread_join(th, NULL));
+  /* The operation left in the queue of a is gone */
+  assert(!thread_chan_destroy(&a));
+  /* A close wakes it up */
+  ops[0].chan = NULL;
+  assert(!thread_create(&th, closer, &b));
+  assert(thread_chan_select(ops, 2, 1) == 1);
+  assert(ops[1].status == EPIPE);
+  assert(!thread_join(th, NULL));
+  assert(!thread_chan_destroy(&b));
+
+  /* Closed while a batch is sent: the items sent are counted and received */
+  assert(!thread_chan_init(&a, 4, sizeof(int)));
+  assert(!thread_create(&th, full_closer, &a));
+  assert(thread_chan_send_batch(&a, items, 6) == 4);
+  assert(!thread_join(th, NULL));
+  assert(thread_chan_recv_batch(&a, items, CAPACITY) == 4);
+  assert(!thread_chan_destroy(&a));
+}
+
+int main(int argc, char *argv[])
+{
+  int i;
+
+  if (argc < 3) {
+    printf("missing arguments: number of stages, then number of messages\n");
+    return -1;
+  }
+  nb_stages = atoi(argv[1]);
+  nb_msgs = atoi(argv[2]);
+
+  check();
+
+  chans = malloc((nb_stages + 1) * sizeof(thread_chan_t));
+  queues = malloc((nb_stages + 1) * sizeof(struct queue));
+  for (i = 0; i <= nb_stages; i++) {
+    thread_mutex_init(&queues[i].mutex);
+    queues[i].head = queues[i].count = 0;
+  }
+
+  for (i = 0; i <= nb_stages; i++)
+    assert(!thread_chan_init(&chans[i], CAPACITY, sizeof(uint64_t)));
+  run("channels", chan_source, chan_stage, chan_sink);
+  for (i = 0; i <= nb_stages; i++) {
+    assert(!thread_chan_destroy(&chans[i]));
+    assert(!thread_chan_init(&chans[i], CAPACITY, sizeof(uint64_t)));
+  }
+  run("batches", batch_source, batch_stage, batch_sink);
+  for (i = 0; i <= nb_stages; i++)
+    assert(!thread_chan_destroy(&chans[i]));
+  run("mutex+yield", queue_source, queue_stage, queue_sink);
+
+  for (i = 0; i <= nb_stages; i++)
+    thread_mutex_destroy(&queues[i].mutex);
+  free(chans);
+  free(queues);
+  return 0;
+}
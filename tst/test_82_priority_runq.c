@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include "../src/thread.h"
+
+/* Test of the priority run queues
+ *
+ * The runnable threads of the highest priority run first, in the order
+ * they were created. A low priority thread waiting behind two high priority
+ * threads yielding to each other runs anyway after a while (aging).
+ *
+ * needed:
+ * - thread_create_ex(), thread_attr_setpriority()
+ * - thread_join()
+ * - thread_yield()
+ */
+
+#define MAX_THREADS 10
+#define MAX_YIELDS 100000
+
+static int order[3 * MAX_THREADS];
+static int nb_run = 0;
+static int low_ran = 0;
+static int nb_yields = 0;
+
+static void * record(void *arg)
+{
+  order[nb_run++] = (int) (long) arg;
+  return NULL;
+}
+
+static void * busy(void *arg)
+{
+  while (!low_ran && nb_yields < MAX_YIELDS) {
+    nb_yields++;
+    thread_yield();
+  }
+  return NULL;
+}
+
+static void * low(void *arg)
+{
+  low_ran = 1;
+  return NULL;
+}
+
+static thread_t create(int priority, void *(*func)(void *), void *arg)
+{
+  thread_attr_t attr;
+  thread_t th;
+  int err;
+
+  thread_attr_init(&attr);
+  thread_attr_setpriority(&attr, priority);
+  err = thread_create_ex(&th, &attr, func, arg);
+  assert(!err);
+  return th;
+}
+
+int main(int argc, char *argv[])
+{
+  static int priorities[3] = {1, 5, 10};
+  thread_t th[3 * MAX_THREADS];
+  int i, j, nb;
+
+  if (argc < 2) {
+    printf("missing argument: number of threads\n");
+    return -1;
+  }
+  nb = atoi(argv[1]);
+  if (nb > MAX_THREADS)
+    nb = MAX_THREADS;
+
+  /* Created from the lowest priority to the highest, run from the highest */
+  for (j = 0; j < 3; j++)
+    for (i = 0; i < nb; i++)
+      th[j * nb + i] = create(priorities[j], record, (void *) (long) priorities[j]);
+  for (i = 0; i < 3 * nb; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(nb_run == 3 * nb);
+  for (i = 1; i < 3 * nb; i++)
+    assert(order[i - 1] >= order[i]);
+
+  /* The low priority thread is not starved */
+  th[0] = create(1, low, NULL);
+  th[1] = create(10, busy, NULL);
+  th[2] = create(10, busy, NULL);
+  for (i = 0; i < 3; i++)
+    assert(!thread_join(th[i], NULL));
+  assert(low_ran);
+  printf("%d threads run by priority, low priority thread run after %d yields\n", 3 * nb, nb_yields);
+  assert(nb_yields < MAX_YIELDS);
+
+  return 0;
+}
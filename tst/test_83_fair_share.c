@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the fair policy (THREAD_SCHED=fair), and benchmark of the CPU share
+ *
+ * Three batch threads of priorities 2, 5 and 8 compute all the time, two
+ * interactive threads of priority 5 compute for WORK microseconds and then
+ * block in thread_join on a new thread, again and again. Each thread counts
+ * the time it runs; its share of the total should be its priority divided by
+ * the sum of the priorities. The deviation from this target is printed for
+ * each thread and checked with the fair policy.
+ *
+ * needed:
+ * - thread_create_ex(), thread_attr_setpriority()
+ * - thread_join()
+ */
+
+#define NB 5
+#define WORK 200 // computing time of the interactive threads between two blocks, in microseconds
+#define GAP 50 // a longer gap between two readings of the clock means that the thread did not run
+#define MAX_DEVIATION 0.25
+
+struct share {
+  int priority;
+  int interactive;
+  uint64_t run;
+  uint64_t last;
+};
+
+static uint64_t end;
+
+static uint64_t account(struct share *s)
+{
+  uint64_t t = now_us();
+  if (t - s->last < GAP)
+    s->run += t - s->last;
+  s->last = t;
+  return t;
+}
+
+static void * nothing(void *arg)
+{
+  return NULL;
+}
+
+static void * func(void *arg)
+{
+  struct share *s = arg;
+  thread_t th;
+
+  while (account(s) < end) {
+    if (s->interactive) {
+      uint64_t until = now_us() + WORK;
+      while (account(s) < until)
+        ;
+      assert(!thread_create(&th, nothing, NULL));
+      assert(!thread_join(th, NULL));
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  struct share shares[NB] = {
+    {2, 0, 0, 0}, {5, 0, 0, 0}, {8, 0, 0, 0}, {5, 1, 0, 0}, {5, 1, 0, 0}
+  };
+  thread_attr_t attr;
+  thread_t th[NB];
+  uint64_t total = 0;
+  int i, sum = 0;
+  double worst = 0;
+  const char *policy = getenv("THREAD_SCHED");
+
+  if (argc < 2) {
+    printf("missing argument: duration in milliseconds\n");
+    return -1;
+  }
+  end = now_us() + 1000 * (uint64_t) atoi(argv[1]);
+
+  for (i = 0; i < NB; i++) {
+    thread_attr_init(&attr);
+    thread_attr_setpriority(&attr, shares[i].priority);
+    assert(!thread_create_ex(&th[i], &attr, func, &shares[i]));
+    sum += shares[i].priority;
+  }
+  for (i = 0; i < NB; i++) {
+    assert(!thread_join(th[i], NULL));
+    total += shares[i].run;
+  }
+
+  printf("policy %s\n", policy ? policy : "priority");
+  for (i = 0; i < NB; i++) {
+    double share = (double) shares[i].run / total;
+    double target = (double) shares[i].priority / sum;
+    double deviation = (share - target) / target;
+    printf("%s priority %d: share %.3f target %.3f deviation %+.3f\n",
+           shares[i].interactive ? "interactive" : "batch", shares[i].priority, share, target, deviation);
+    if (deviation < 0) deviation = -deviation;
+    if (deviation > worst) worst = deviation;
+  }
+  printf("worst deviation %.3f\n", worst);
+
+  if (policy != NULL && strcmp(policy, "fair") == 0)
+    assert(worst < MAX_DEVIATION);
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+#include <errno.h>
+#include "../src/thread.h"
+#include "test_time.h"
+
+/* Test of the periodic threads (EDF), and benchmark of the deadline misses
+ *
+ * A set of periodic tasks runs for the duration given, each job computing
+ * for its cost. With thread_attr_setdeadline the scheduler runs the earliest
+ * deadline first and counts the misses; with plain threads the periods are
+ * emulated by yielding until the next release (round-robin). The misses of
+ * both are printed for a set using 75% of the processor, where EDF must not
+ * miss deadlines, and for an overloaded set using 112%. A periodic thread
+ * blocked on a mutex held by a batch thread must also run at the next tick
+ * once the mutex is unlocked, not at the end of the timeslice of the batch
+ * thread.
+ *
+ * needed:
+ * - thread_create_ex(), thread_attr_setdeadline()
+ * - thread_wait_period(), thread_get_deadline_misses()
+ * - thread_yield(), thread_join()
+ * - thread_mutex_lock(), thread_mutex_unlock(), thread_attr_setpriority()
+ */
+
+#define MAX_TASKS 3
+#define GAP 50 // a longer gap between two readings of the clock means that the thread did not run
+
+struct task {
+  unsigned int period; // all in microseconds
+  unsigned int deadline;
+  unsigned int cost;
+  unsigned int jobs;
+  unsigned int misses;
+  int edf;
+};
+
+/* Computes until the thread has run for cost microseconds */
+static void work(unsigned int cost)
+{
+  uint64_t run = 0, last = now_us(), t;
+  while (run < cost) {
+    t = now_us();
+    if (t - last < GAP)
+      run += t - last;
+    last = t;
+  }
+}
+
+static void * func(void *arg)
+{
+  struct task *task = arg;
+  uint64_t release = now_us(), t;
+  unsigned int i;
+
+  for (i = 0; i < task->jobs; i++) {
+    work(task->cost);
+    if (task->edf) {
+      assert(!thread_wait_period());
+      continue;
+    }
+
+    /* Same accounting as thread_wait_period */
+    t = now_us();
+    if (t > release + task->deadline)
+      task->misses++;
+    release += task->period;
+    while (release + task->deadline <= t) {
+      release += task->period;
+      task->misses++;
+    }
+    while (now_us() < release)
+      thread_yield();
+  }
+  if (task->edf)
+    task->misses = thread_get_deadline_misses(thread_self());
+  return NULL;
+}
+
+static thread_mutex_t mutex;
+static volatile int trying;
+static uint64_t unlocked, taken;
+
+/* Periodic: waits for the mutex held by the batch thread */
+static void * blocked(void *arg)
+{
+  trying = 1;
+  assert(!thread_mutex_lock(&mutex));
+  taken = now_us();
+  assert(!thread_mutex_unlock(&mutex));
+  return NULL;
+}
+
+/* Batch, with the longest timeslice: holds the mutex, then computes without yielding */
+static void * batch(void *arg)
+{
+  thread_attr_t attr;
+  thread_t th;
+
+  assert(!thread_mutex_lock(&mutex));
+  thread_attr_init(&attr);
+  assert(!thread_attr_setdeadline(&attr, 100000, 100000));
+  assert(!thread_create_ex(&th, &attr, blocked, NULL));
+  while (!trying)
+    ;
+  work(2000);
+  unlocked = now_us();
+  assert(!thread_mutex_unlock(&mutex));
+  work(30000);
+  assert(!thread_join(th, NULL));
+  return NULL;
+}
+
+/* Returns the time the periodic thread waited once the mutex was unlocked */
+static uint64_t wake_latency(void)
+{
+  thread_attr_t attr;
+  thread_t th;
+
+  trying = 0;
+  assert(!thread_mutex_init(&mutex));
+  thread_attr_init(&attr);
+  assert(!thread_attr_setpriority(&attr, 10));
+  assert(!thread_create_ex(&th, &attr, batch, NULL));
+  assert(!thread_join(th, NULL));
+  assert(!thread_mutex_destroy(&mutex));
+  return taken - unlocked;
+}
+
+/* Runs the tasks for duration microseconds, returns the number of misses */
+static unsigned int run(struct task *tasks, int nb, int edf, unsigned int duration, unsigned int *jobs)
+{
+  thread_attr_t attr;
+  thread_t th[MAX_TASKS];
+  unsigned int misses = 0;
+  int i;
+
+  *jobs = 0;
+  for (i = 0; i < nb; i++) {
+    tasks[i].jobs = duration / tasks[i].period;
+    tasks[i].misses = 0;
+    tasks[i].edf = edf;
+    *jobs += tasks[i].jobs;
+    thread_attr_init(&attr);
+    if (edf)
+      assert(!thread_attr_setdeadline(&attr, tasks[i].period, tasks[i].deadline));
+    assert(!thread_create_ex(&th[i], &attr, func, &tasks[i]));
+  }
+  for (i = 0; i < nb; i++) {
+    assert(!thread_join(th[i], NULL));
+    misses += tasks[i].misses;
+  }
+  return misses;
+}
+
+int main(int argc, char *argv[])
+{
+  struct task tasks[MAX_TASKS] = {
+    {20000, 10000, 3000, 0, 0, 0},
+    {50000, 50000, 30000, 0, 0, 0},
+    {40000, 40000, 15000, 0, 0, 0}
+  };
+  thread_attr_t attr;
+  unsigned int duration, jobs, edf, rr, latency;
+
+  if (argc < 2) {
+    printf("missing argument: duration in milliseconds\n");
+    return -1;
+  }
+  duration = 1000 * atoi(argv[1]);
+
+  thread_attr_init(&attr);
+  assert(thread_attr_setdeadline(&attr, 1000, 2000) == EINVAL);
+  assert(thread_wait_period() == EINVAL);
+
+  /* 75% of the processor */
+  edf = run(tasks, 2, 1, duration, &jobs);
+  rr = run(tasks, 2, 0, duration, &jobs);
+  printf("load 0.75: %u jobs, misses edf %u round-robin %u\n", jobs, edf, rr);
+  /* The process itself may be descheduled by the kernel for a few milliseconds */
+  assert(edf <= 1);
+
+  /* Overload, 112% of the processor */
+  edf = run(tasks, 3, 1, duration, &jobs);
+  rr = run(tasks, 3, 0, duration, &jobs);
+  printf("load 1.12: %u jobs, misses edf %u round-robin %u\n", jobs, edf, rr);
+
+  /* Woken up by the unlock: a few ticks at most, the timeslice of the batch thread is 22 ms */
+  latency = wake_latency();
+  printf("periodic thread woken up by a batch thread: runs after %u us\n", latency);
+  assert(latency < 10000);
+
+  return 0;
+}
@@ -0,0 +1,26 @@
+/**
+  * \file test_time.h
+  * \brief the monotonic clock of the tests and benchmarks
+  */
+
+#ifndef TEST_TIME_H
+#define TEST_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* The monotonic clock in nanoseconds */
+static inline uint64_t now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The monotonic clock in microseconds */
+static inline uint64_t now_us(void)
+{
+  return now() / 1000;
+}
+
+#endif /* TEST_TIME_H */